@@ -0,0 +1,106 @@
+#include <mpfr.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "orbit-cache.h"
+#include "render.h"
+#include "thread-pool.h"
+
+static void
+usage (const char *program)
+{
+  fprintf (stderr,
+           "usage: %s <center_re> <center_im> <scale> <max_iter> <width> "
+           "<height> <output.ppm> [threads [samples]]\n",
+           program);
+}
+
+int
+main (int argc, char **argv)
+{
+  if (argc < 8 || argc > 10)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  int max_iter = atoi (argv[4]);
+  int width = atoi (argv[5]);
+  int height = atoi (argv[6]);
+  const char *output = argv[7];
+
+  int threads = argc >= 9 ? atoi (argv[8])
+                          : (int)sysconf (_SC_NPROCESSORS_ONLN);
+  int samples = argc == 10 ? atoi (argv[9]) : 1;
+
+  if (max_iter <= 0 || width <= 0 || height <= 0 || threads <= 0
+      || samples <= 0)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  mpfr_t center_re, center_im, scale;
+  mpfr_init2 (scale, 64);
+
+  if (mpfr_set_str (scale, argv[3], 10, MPFR_RNDN) != 0
+      || mpfr_sgn (scale) <= 0)
+    {
+      fprintf (stderr, "%s: invalid scale\n", argv[0]);
+      mpfr_clear (scale);
+      return 1;
+    }
+
+  mpfr_inits2 (render_precision (scale), center_re, center_im, (mpfr_ptr)0);
+
+  if (mpfr_set_str (center_re, argv[1], 10, MPFR_RNDN) != 0
+      || mpfr_set_str (center_im, argv[2], 10, MPFR_RNDN) != 0)
+    {
+      fprintf (stderr, "%s: invalid center\n", argv[0]);
+      mpfr_clears (center_re, center_im, scale, (mpfr_ptr)0);
+      return 1;
+    }
+
+  render_init (width, height);
+  render_reset ();
+
+  g_orbit_cache = orbit_cache_create (NULL, ORBIT_CACHE_LIMIT);
+
+  g_orbit_re = calloc (max_iter + 1, sizeof (double));
+  g_orbit_im = calloc (max_iter + 1, sizeof (double));
+
+  struct thread_pool *pool;
+
+  pool = thread_pool_create (threads, 32768 * 8);
+
+  render_enqueue_orbit (pool, NULL, center_re, center_im, scale, max_iter);
+  render_enqueue_pass (pool, NULL, 1, center_re, center_im, scale, max_iter);
+  thread_pool_wait (pool);
+
+  render_enqueue_supersample (pool, NULL, samples, center_re, center_im,
+                              scale, max_iter);
+  thread_pool_wait (pool);
+
+  int status = 0;
+
+  if (render_write_ppm (output) != 0)
+    {
+      perror (output);
+      status = 1;
+    }
+
+  thread_pool_destroy (pool);
+
+  orbit_cache_destroy (g_orbit_cache);
+
+  free (g_orbit_re);
+  free (g_orbit_im);
+
+  render_quit ();
+
+  mpfr_clears (center_re, center_im, scale, (mpfr_ptr)0);
+
+  return status;
+}
@@ -0,0 +1,152 @@
+#include <mpfr.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "render.h"
+#include "thread-pool.h"
+
+// The needle location that used to be hard-coded (commented out) in main.c.
+#define NEEDLE_RE                                                          \
+  "-1.9859193599609786844532231921932459642714290626665437753863504737466" \
+  "7190487595738448086522222647631362020258381746995697085263870180716952" \
+  "1470642552907749357586890444572682637018316051868610025537670443440689" \
+  "0268794540183930077241726577277291673229092467428795560444700591516040" \
+  "19800566771833620747885755006452251"
+
+#define NEEDLE_IM                                                          \
+  "-0.0000000000000000000000000000000000000000000000000000000000000000000" \
+  "0000000000000000000000000000000000000000000000000000000000000000000000" \
+  "0000000000006782124306204586224913052674274234088876732613361895499319" \
+  "3702027020201663235754890350269647956308840775941680434422170336952819" \
+  "5270240611711018734136689857005888"
+
+struct bench_location
+{
+  const char *name;
+  const char *center_re;
+  const char *center_im;
+  const char *scale;
+  int max_iter[3];
+};
+
+static const struct bench_location locations[] = {
+  { "shallow", "-0.75", "0.0", "0.005", { 256, 1024, 4096 } },
+  { "needle-e50", NEEDLE_RE, NEEDLE_IM, "1e-50", { 4096, 16384, 65536 } },
+  { "needle-e150", NEEDLE_RE, NEEDLE_IM, "1e-150", { 4096, 16384, 65536 } },
+  { "needle-e300", NEEDLE_RE, NEEDLE_IM, "1e-300", { 4096, 16384, 65536 } },
+};
+
+static const int locations_amount = sizeof locations / sizeof locations[0];
+
+static double
+bench_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+bench_run (struct thread_pool *pool, int threads,
+           const struct bench_location *location, int max_iter)
+{
+  mpfr_t center_re, center_im, scale;
+  mpfr_init2 (scale, 64);
+  mpfr_set_str (scale, location->scale, 10, MPFR_RNDN);
+
+  mpfr_inits2 (render_precision (scale), center_re, center_im, (mpfr_ptr)0);
+  mpfr_set_str (center_re, location->center_re, 10, MPFR_RNDN);
+  mpfr_set_str (center_im, location->center_im, 10, MPFR_RNDN);
+
+  g_orbit_re = realloc (g_orbit_re, (max_iter + 1) * sizeof (double));
+  g_orbit_im = realloc (g_orbit_im, (max_iter + 1) * sizeof (double));
+
+  // A new generation, so the work of the last run goes back to the arena.
+  atomic_fetch_add (&g_generation, 1);
+  render_reset ();
+
+  atomic_store (&g_orbit_ready, 0);
+  atomic_store (&g_stat_iterations, 0);
+  atomic_store (&g_stat_rebases, 0);
+
+  double start_orbit = bench_now ();
+
+  render_enqueue_orbit (pool, NULL, center_re, center_im, scale, max_iter);
+  thread_pool_wait (pool);
+
+  double start_pixels = bench_now ();
+
+  render_enqueue_pass (pool, NULL, 1, center_re, center_im, scale, max_iter);
+  thread_pool_wait (pool);
+
+  double start_color = bench_now ();
+
+  // Recoloring alone, as after a palette change.
+  render_enqueue_color (pool, NULL);
+  thread_pool_wait (pool);
+
+  double end = bench_now ();
+
+  double time_orbit = start_pixels - start_orbit;
+  double time_pixels = start_color - start_pixels;
+  double time_color = end - start_color;
+
+  long long iterations = atomic_load (&g_stat_iterations);
+  long long rebases = atomic_load (&g_stat_rebases);
+
+  double rate = iterations / (time_pixels / 1e3) / threads;
+
+  printf ("%-12s %9d %10.1f %10.1f %10.1f %10.1f %14lld %10.2f %12lld\n",
+          location->name, max_iter, time_orbit, time_pixels, time_color,
+          time_orbit + time_pixels, iterations, rate / 1e6, rebases);
+
+  mpfr_clears (center_re, center_im, scale, (mpfr_ptr)0);
+}
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 4)
+    {
+      fprintf (stderr, "usage: %s [width] [height] [threads]\n", argv[0]);
+      return 1;
+    }
+
+  int width = argc > 1 ? atoi (argv[1]) : 320;
+  int height = argc > 2 ? atoi (argv[2]) : 240;
+  int threads = argc > 3 ? atoi (argv[3])
+                         : (int)sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (width <= 0 || height <= 0 || threads <= 0)
+    {
+      fprintf (stderr, "usage: %s [width] [height] [threads]\n", argv[0]);
+      return 1;
+    }
+
+  render_init (width, height);
+
+  struct thread_pool *pool;
+
+  pool = thread_pool_create (threads, 32768 * 8);
+
+  printf ("# %dx%d, %d threads\n", width, height, threads);
+  printf ("%-12s %9s %10s %10s %10s %10s %14s %10s %12s\n", "location",
+          "max_iter", "orbit_ms", "pixel_ms", "color_ms", "total_ms",
+          "iterations", "Mit/s/thr", "rebases");
+
+  for (int i = 0; i < locations_amount; ++i)
+    for (int j = 0; j < 3; ++j)
+      bench_run (pool, threads, &locations[i], locations[i].max_iter[j]);
+
+  thread_pool_destroy (pool);
+
+  free (g_orbit_re);
+  free (g_orbit_im);
+
+  render_quit ();
+
+  return 0;
+}
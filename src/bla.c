@@ -0,0 +1,114 @@
+#include "bla.h"
+#include <math.h>
+#include <stdlib.h>
+
+
+// Relative size of the dropped quadratic term that is still accepted.
+#define BLA_EPSILON 0x1p-53
+
+
+static void
+bla_single (const double *orbit_re, const double *orbit_im, int m,
+            struct bla *out)
+{
+  out->a_re = 2.0 * orbit_re[m];
+  out->a_im = 2.0 * orbit_im[m];
+  out->b_re = 1.0;
+  out->b_im = 0.0;
+  out->r = BLA_EPSILON * hypot (out->a_re, out->a_im);
+  out->length = 1;
+}
+
+
+static void
+bla_merge (const struct bla *x, const struct bla *y, struct floatexp dc_max,
+           struct bla *out)
+{
+  double ax = hypot (x->a_re, x->a_im);
+  double bx = hypot (x->b_re, x->b_im);
+
+  out->a_re = y->a_re * x->a_re - y->a_im * x->a_im;
+  out->a_im = y->a_re * x->a_im + y->a_im * x->a_re;
+
+  out->b_re = y->a_re * x->b_re - y->a_im * x->b_im + y->b_re;
+  out->b_im = y->a_re * x->b_im + y->a_im * x->b_re + y->b_im;
+
+  double r = 0.0;
+
+  if (ax > 0.0)
+    r = fmax (0.0, (y->r - ldexp (bx * dc_max.mant, dc_max.exp)) / ax);
+
+  out->r = fmin (x->r, r);
+  out->length = x->length + y->length;
+}
+
+
+static void
+bla_table_reserve (struct bla_table *table, int level, int amount)
+{
+  if (table->capacity[level] < amount)
+    {
+      table->levels[level]
+          = realloc (table->levels[level], amount * sizeof (struct bla));
+      table->capacity[level] = amount;
+    }
+
+  table->amount[level] = amount;
+}
+
+
+void
+bla_table_build (struct bla_table *table, const double *orbit_re,
+                 const double *orbit_im, int orbit_amount,
+                 struct floatexp dc_max)
+{
+  table->levels_amount = 1;
+
+  if (orbit_amount < 4)
+    return;
+
+  bla_table_reserve (table, 1, (orbit_amount - 2) >> 1);
+
+  for (int j = 0; j < table->amount[1]; ++j)
+    {
+      struct bla x, y;
+
+      bla_single (orbit_re, orbit_im, 1 + 2 * j, &x);
+      bla_single (orbit_re, orbit_im, 2 + 2 * j, &y);
+
+      bla_merge (&x, &y, dc_max, &table->levels[1][j]);
+    }
+
+  int level = 2;
+
+  while (level < BLA_LEVELS_MAX && ((orbit_amount - 2) >> level) > 0)
+    {
+      bla_table_reserve (table, level, (orbit_amount - 2) >> level);
+
+      const struct bla *below = table->levels[level - 1];
+
+      for (int j = 0; j < table->amount[level]; ++j)
+        bla_merge (&below[2 * j], &below[2 * j + 1], dc_max,
+                   &table->levels[level][j]);
+
+      level++;
+    }
+
+  table->levels_amount = level;
+}
+
+
+void
+bla_table_free (struct bla_table *table)
+{
+  for (int i = 0; i < BLA_LEVELS_MAX; ++i)
+    {
+      free (table->levels[i]);
+
+      table->levels[i] = NULL;
+      table->amount[i] = 0;
+      table->capacity[i] = 0;
+    }
+
+  table->levels_amount = 0;
+}
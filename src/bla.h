@@ -0,0 +1,85 @@
+#ifndef BLA_H
+#define BLA_H
+
+#include <stddef.h>
+
+#include "floatexp.h"
+
+#define BLA_LEVELS_MAX 32
+
+// One bivariate linear approximation: dz[m + length] = a * dz[m] + b * dc,
+// valid while |dz[m]| < r.
+struct bla
+{
+  double a_re;
+  double a_im;
+  double b_re;
+  double b_im;
+  double r;
+  int length;
+};
+
+// Level k holds the approximations of length 2^k, starting at orbit indices
+// 1, 1 + 2^k, 1 + 2 * 2^k, ...  Level 0 (single steps) is not stored, the
+// plain perturbation step is just as fast.
+struct bla_table
+{
+  struct bla *levels[BLA_LEVELS_MAX];
+  int         amount[BLA_LEVELS_MAX];
+  int         capacity[BLA_LEVELS_MAX];
+  int         levels_amount;
+};
+
+void bla_table_build (struct bla_table *, const double *, const double *, int,
+                      struct floatexp);
+
+void bla_table_free (struct bla_table *);
+
+// Longest approximation starting at orbit index m that is valid for a delta
+// of squared magnitude dz_norm * 2^(2 * dz_exp) and does not run past
+// iter_left iterations.
+static inline const struct bla *
+bla_table_lookup (const struct bla_table *table, int m, double dz_norm,
+                  long dz_exp, int iter_left)
+{
+  if (m < 1 || !(m & 1) || iter_left < 2 || table->levels_amount < 2)
+    return NULL;
+
+  // Radii only shrink with length, so a failing level 1 rules out the rest.
+  if ((m - 1) >> 1 >= table->amount[1])
+    return NULL;
+
+  const struct bla *first = &table->levels[1][(m - 1) >> 1];
+
+  double r = dz_exp ? ldexp (first->r, -dz_exp) : first->r;
+
+  if (dz_norm >= r * r)
+    return NULL;
+
+  int level = table->levels_amount - 1;
+
+  if (m > 1 && __builtin_ctz (m - 1) < level)
+    level = __builtin_ctz (m - 1);
+
+  for (; level >= 1; --level)
+    {
+      if ((1 << level) > iter_left)
+        continue;
+
+      int j = (m - 1) >> level;
+
+      if (j >= table->amount[level])
+        continue;
+
+      const struct bla *bla = &table->levels[level][j];
+
+      r = dz_exp ? ldexp (bla->r, -dz_exp) : bla->r;
+
+      if (dz_norm < r * r)
+        return bla;
+    }
+
+  return NULL;
+}
+
+#endif // BLA_H
@@ -0,0 +1,347 @@
+#include <math.h>
+#include <mpfr.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "orbit-cache.h"
+#include "render.h"
+#include "thread-pool.h"
+
+// The strip goes from half a pixel of the final view out from its center to
+// EXPMAP_RADIUS out, past all of the set.  Its rows are rendered
+// g_width at a time, against the orbit of the deepest ones until they are
+// shallow enough to be iterated directly.
+#define EXPMAP_RADIUS 4.0
+
+static void
+usage (const char *program)
+{
+  fprintf (stderr,
+           "usage: %s strip <center_re> <center_im> <scale> <max_iter> "
+           "<width> <output.ppm> [threads [samples]]\n"
+           "       %s frames <strip.ppm> <width> <height> <zoom>\n",
+           program, program);
+}
+
+static int
+expmap_write_rows (FILE *file, int rows)
+{
+  uint8_t *rgb = malloc ((size_t)g_width * 3);
+
+  for (int y = 0; y < rows; ++y)
+    {
+      for (int x = 0; x < g_width; ++x)
+        {
+          uint32_t pixel = pixels[(size_t)y * g_width + x];
+
+          rgb[3 * x] = (pixel >> 16) & 0xFF;
+          rgb[3 * x + 1] = (pixel >> 8) & 0xFF;
+          rgb[3 * x + 2] = pixel & 0xFF;
+        }
+
+      if (fwrite (rgb, 3, g_width, file) != (size_t)g_width)
+        {
+          free (rgb);
+          return -1;
+        }
+    }
+
+  free (rgb);
+  return 0;
+}
+
+// Renders the exponential map of the zoom from the view of pixel spacing
+// scale around the center all the way out, as a strip of width columns.
+static int
+expmap_strip (const char *program, int argc, char **argv)
+{
+  if (argc < 6 || argc > 8)
+    {
+      usage (program);
+      return 1;
+    }
+
+  int max_iter = atoi (argv[3]);
+  int width = atoi (argv[4]);
+  const char *output = argv[5];
+
+  int threads = argc >= 7 ? atoi (argv[6])
+                          : (int)sysconf (_SC_NPROCESSORS_ONLN);
+  int samples = argc == 8 ? atoi (argv[7]) : 1;
+
+  if (max_iter <= 0 || width <= 0 || threads <= 0 || samples <= 0)
+    {
+      usage (program);
+      return 1;
+    }
+
+  mpfr_t center_re, center_im, scale, factor;
+  mpfr_inits2 (64, scale, factor, (mpfr_ptr)0);
+
+  if (mpfr_set_str (scale, argv[2], 10, MPFR_RNDN) != 0
+      || mpfr_sgn (scale) <= 0)
+    {
+      fprintf (stderr, "%s: invalid scale\n", program);
+      mpfr_clears (scale, factor, (mpfr_ptr)0);
+      return 1;
+    }
+
+  // Row 0 lies width / 2 pi of its pixel spacings out, which is to be half
+  // a pixel of the view.
+  mpfr_log (factor, scale, MPFR_RNDN);
+
+  int rows = (int)ceil (width / (2 * M_PI)
+                        * (log (2 * EXPMAP_RADIUS)
+                           - mpfr_get_d (factor, MPFR_RNDN)));
+
+  mpfr_mul_d (scale, scale, M_PI / width, MPFR_RNDN);
+
+  mpfr_inits2 (render_precision (scale), center_re, center_im, (mpfr_ptr)0);
+
+  if (mpfr_set_str (center_re, argv[0], 10, MPFR_RNDN) != 0
+      || mpfr_set_str (center_im, argv[1], 10, MPFR_RNDN) != 0)
+    {
+      fprintf (stderr, "%s: invalid center\n", program);
+      mpfr_clears (center_re, center_im, scale, factor, (mpfr_ptr)0);
+      return 1;
+    }
+
+  FILE *file = fopen (output, "wb");
+
+  if (!file)
+    {
+      perror (output);
+      mpfr_clears (center_re, center_im, scale, factor, (mpfr_ptr)0);
+      return 1;
+    }
+
+  fprintf (file, "P6\n%d %d\n255\n", width, rows);
+
+  int segment = rows < width ? rows : width;
+
+  render_init (width, segment);
+  render_set_map (RENDER_MAP_EXP);
+
+  g_orbit_cache = orbit_cache_create (NULL, ORBIT_CACHE_LIMIT);
+
+  g_orbit_re = calloc (max_iter + 1, sizeof (double));
+  g_orbit_im = calloc (max_iter + 1, sizeof (double));
+
+  struct thread_pool *pool;
+
+  pool = thread_pool_create (threads, 32768 * 8);
+
+  mpfr_t segment_scale;
+  mpfr_init2 (segment_scale, 64);
+
+  int status = 0;
+
+  for (int y = 0; y < rows && status == 0; y += segment)
+    {
+      mpfr_set_d (factor, 2 * M_PI * y / width, MPFR_RNDN);
+      mpfr_exp (factor, factor, MPFR_RNDN);
+      mpfr_mul (segment_scale, scale, factor, MPFR_RNDN);
+
+      atomic_fetch_add (&g_generation, 1);
+      render_reset ();
+
+      render_enqueue_orbit (pool, NULL, center_re, center_im, segment_scale,
+                            max_iter);
+      render_enqueue_pass (pool, NULL, 1, center_re, center_im,
+                           segment_scale, max_iter);
+      thread_pool_wait (pool);
+
+      render_enqueue_supersample (pool, NULL, samples, center_re, center_im,
+                                  segment_scale, max_iter);
+      thread_pool_wait (pool);
+
+      if (expmap_write_rows (file, rows - y < segment ? rows - y : segment)
+          != 0)
+        status = 1;
+    }
+
+  if (fclose (file) != 0)
+    status = 1;
+
+  if (status != 0)
+    perror (output);
+
+  thread_pool_destroy (pool);
+
+  orbit_cache_destroy (g_orbit_cache);
+
+  free (g_orbit_re);
+  free (g_orbit_im);
+
+  render_quit ();
+
+  mpfr_clears (center_re, center_im, scale, factor, segment_scale,
+               (mpfr_ptr)0);
+
+  return status;
+}
+
+// Row of the strip where the point distance pixels away from the center of a
+// view lies, with the final view at zoom 1.
+static double
+expmap_row (int width, double distance, double zoom)
+{
+  return width / (2 * M_PI) * log (2 * distance * zoom);
+}
+
+// Resamples the frames of a zoom of width by height pixels, zoom times
+// deeper each, from the strip, and writes them to stdout as raw RGB.  Only
+// the rows a frame needs are read.
+static int
+expmap_frames (const char *program, int argc, char **argv)
+{
+  if (argc != 4)
+    {
+      usage (program);
+      return 1;
+    }
+
+  const char *input = argv[0];
+  int width = atoi (argv[1]);
+  int height = atoi (argv[2]);
+  double zoom_step = atof (argv[3]);
+
+  if (width <= 0 || height <= 0 || !(zoom_step > 1.0))
+    {
+      usage (program);
+      return 1;
+    }
+
+  FILE *file = fopen (input, "rb");
+
+  if (!file)
+    {
+      perror (input);
+      return 1;
+    }
+
+  int strip_width, strip_rows, depth;
+
+  if (fscanf (file, "P6 %d %d %d", &strip_width, &strip_rows, &depth) != 3
+      || depth != 255 || strip_width <= 0 || strip_rows <= 0
+      || fgetc (file) == EOF)
+    {
+      fprintf (stderr, "%s: %s is no strip\n", program, input);
+      fclose (file);
+      return 1;
+    }
+
+  long header = ftell (file);
+
+  // Frames go from about where their corners reach the end of the strip to
+  // the final view.
+  double corner = hypot (width / 2.0, height / 2.0);
+  int frames = (int)floor ((2 * M_PI * (strip_rows - 1) / strip_width
+                            - log (2 * corner))
+                           / log (zoom_step));
+
+  size_t row_size = (size_t)strip_width * 3;
+  uint8_t *band = NULL;
+  uint8_t *frame = malloc ((size_t)width * height * 3);
+
+  int status = 0;
+
+  for (int i = frames; i >= 0 && status == 0; --i)
+    {
+      double zoom = pow (zoom_step, i);
+
+      // The center pixels take the row half a pixel out.
+      int first = (int)floor (expmap_row (strip_width, 0.5, zoom));
+      int last = (int)ceil (expmap_row (strip_width, corner, zoom)) + 1;
+
+      if (first < 0)
+        first = 0;
+
+      if (last > strip_rows - 1)
+        last = strip_rows - 1;
+
+      band = realloc (band, (last - first + 1) * row_size);
+
+      if (fseek (file, header + (long)(first * row_size), SEEK_SET) != 0
+          || fread (band, row_size, last - first + 1, file)
+                 != (size_t)(last - first + 1))
+        {
+          fprintf (stderr, "%s: %s is cut short\n", program, input);
+          status = 1;
+          break;
+        }
+
+      for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+          {
+            double dx = x + 0.5 - width / 2.0;
+            double dy = y + 0.5 - height / 2.0;
+
+            double u = atan2 (dy, dx) * strip_width / (2 * M_PI);
+            double v = expmap_row (strip_width, fmax (hypot (dx, dy), 0.5),
+                                   zoom);
+
+            if (u < 0)
+              u += strip_width;
+
+            v = fmin (fmax (v, first), last);
+
+            int column = (int)u;
+            int row = (int)v;
+            double frac_u = u - column;
+            double frac_v = v - row;
+
+            if (row == last)
+              {
+                row--;
+                frac_v = 1.0;
+              }
+
+            const uint8_t *p00
+                = &band[(row - first) * row_size + column % strip_width * 3];
+            const uint8_t *p01 = &band[(row - first) * row_size
+                                       + (column + 1) % strip_width * 3];
+            const uint8_t *p10 = p00 + row_size;
+            const uint8_t *p11 = p01 + row_size;
+
+            for (int c = 0; c < 3; ++c)
+              {
+                double top = p00[c] + (p01[c] - p00[c]) * frac_u;
+                double bottom = p10[c] + (p11[c] - p10[c]) * frac_u;
+
+                frame[((size_t)y * width + x) * 3 + c]
+                    = (uint8_t)(top + (bottom - top) * frac_v + 0.5);
+              }
+          }
+
+      if (fwrite (frame, 3, (size_t)width * height, stdout)
+          != (size_t)width * height)
+        {
+          perror ("stdout");
+          status = 1;
+        }
+    }
+
+  free (band);
+  free (frame);
+  fclose (file);
+
+  return status;
+}
+
+int
+main (int argc, char **argv)
+{
+  if (argc >= 2 && strcmp (argv[1], "strip") == 0)
+    return expmap_strip (argv[0], argc - 2, argv + 2);
+
+  if (argc >= 2 && strcmp (argv[1], "frames") == 0)
+    return expmap_frames (argv[0], argc - 2, argv + 2);
+
+  usage (argv[0]);
+  return 1;
+}
@@ -0,0 +1,78 @@
+#ifndef FLOATEXP_H
+#define FLOATEXP_H
+
+#include <math.h>
+
+// A double with a separate exponent: mant * 2^exp, with 0.5 <= |mant| < 1
+// (or mant == 0).  Used for values that leave the range of a plain double,
+// like the pixel spacing and the deltas past 1e-308.
+struct floatexp
+{
+  double mant;
+  long   exp;
+};
+
+// A complex number with one shared exponent: (re + i im) * 2^exp.  The
+// mantissas are kept near 1 but only renormalized when they drift far off,
+// which keeps the arithmetic on them as cheap as on plain doubles.
+struct floatexp_complex
+{
+  double re;
+  double im;
+  long   exp;
+};
+
+#define FLOATEXP_DRIFT 0x1p64
+
+static inline struct floatexp
+floatexp_make (double mant, long exp)
+{
+  int e = 0;
+  struct floatexp result;
+
+  result.mant = frexp (mant, &e);
+  result.exp = mant == 0.0 ? 0 : exp + e;
+
+  return result;
+}
+
+static inline struct floatexp
+floatexp_mul_d (struct floatexp a, double b)
+{
+  return floatexp_make (a.mant * b, a.exp);
+}
+
+static inline double
+floatexp_to_double (struct floatexp a)
+{
+  return ldexp (a.mant, a.exp);
+}
+
+static inline void
+floatexp_complex_normalize (struct floatexp_complex *a)
+{
+  double magnitude = fmax (fabs (a->re), fabs (a->im));
+
+  if (magnitude == 0.0)
+    {
+      a->exp = 0;
+      return;
+    }
+
+  int e = ilogb (magnitude);
+
+  a->re = ldexp (a->re, -e);
+  a->im = ldexp (a->im, -e);
+  a->exp += e;
+}
+
+static inline int
+floatexp_complex_drifted (const struct floatexp_complex *a)
+{
+  double magnitude = fmax (fabs (a->re), fabs (a->im));
+
+  return magnitude > FLOATEXP_DRIFT
+         || (magnitude != 0.0 && magnitude < 1.0 / FLOATEXP_DRIFT);
+}
+
+#endif // FLOATEXP_H
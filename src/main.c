@@ -5,6 +5,9 @@
 #include <stdatomic.h>
 #include <stdio.h>
 
+#include "nucleus.h"
+#include "orbit-cache.h"
+#include "render.h"
 #include "thread-pool.h"
 
 #define WIDTH  800
@@ -14,415 +17,157 @@
 // #define WIDTH  1920
 // #define HEIGHT 1080
 
-#define PRECISION_BITS 1024
-#define ESCAPE_RADIUS 1e6
-
 static int max_iter = 64;
 
+// The coloring, see render_set_coloring.
+static int palette = 0;
+static double frequency = 0.1;
+static double offset = 0.0;
+
+// Samples per pixel on the edges, once a frame is complete.
+static int samples = 1;
+
 static SDL_Window *window;
 static SDL_Renderer *renderer;
 static SDL_Texture *texture;
 
-static atomic_int g_generation;
-static atomic_bool g_orbit_ready;
-
-static double *g_orbit_re;
-static double *g_orbit_im;
-static atomic_int g_orbit_amount;
-
-static uint32_t pixels[WIDTH * HEIGHT];
-static pthread_mutex_t pixels_mutex;
-
-static int64_t pixels_done[WIDTH * HEIGHT];
-static pthread_mutex_t pixels_done_mutex;
-
-static inline uint32_t
-interpolate_color (uint32_t c1, uint32_t c2, double frac)
+SDL_Texture *
+render_text (SDL_Renderer *renderer, TTF_Font *font, const char *text,
+             SDL_Color color, int *out_width, int *out_height)
 {
-  uint8_t r1 = (c1 >> 16) & 0xFF;
-  uint8_t g1 = (c1 >> 8) & 0xFF;
-  uint8_t b1 = c1 & 0xFF;
-
-  uint8_t r2 = (c2 >> 16) & 0xFF;
-  uint8_t g2 = (c2 >> 8) & 0xFF;
-  uint8_t b2 = c2 & 0xFF;
+  SDL_Surface *surface = TTF_RenderText_Blended (font, text, color);
+  SDL_Texture *texture = SDL_CreateTextureFromSurface (renderer, surface);
 
-  uint8_t r = (1.0f - frac) * r1 + frac * r2;
-  uint8_t g = (1.0f - frac) * g1 + frac * g2;
-  uint8_t b = (1.0f - frac) * b1 + frac * b2;
+  *out_width = surface->w;
+  *out_height = surface->h;
 
-  return 0xFF000000 | (r << 16) | (g << 8) | b;
+  SDL_FreeSurface (surface);
+  return texture;
 }
 
-struct orbit_work
-{
-  mpfr_t center_re;
-  mpfr_t center_im;
-  double scale;
-  double *orbit_re;
-  double *orbit_im;
-  int generation;
-};
-
-void
-render_compute_orbit (mpfr_t center_re, mpfr_t center_im, double *orbit_re,
-                      double *orbit_im, int generation)
+// A search for the lowest period minibrot within radius pixels of pixel
+// (x, y) of the view, run in the pool as Newton's method in MPFR can take a
+// while.  The view is its own copy, and the main loop takes up the nucleus,
+// going to re + i im, once done is set.  Whatever moves the generation on
+// ends the search, so clearing the pool does not wait for it.
+struct nucleus_work
 {
-  const double escape_radius_sq = ESCAPE_RADIUS * ESCAPE_RADIUS;
-
-  mpfr_t z_re, z_im, temp_re, temp_im, re_sqr, im_sqr, escape_radius;
-  mpfr_inits2 (PRECISION_BITS, z_re, z_im, temp_re, temp_im, re_sqr, im_sqr,
-               escape_radius, (mpfr_ptr)0);
-
-  mpfr_set_d (z_re, 0.0, MPFR_RNDN);
-  mpfr_set_d (z_im, 0.0, MPFR_RNDN);
-
-  mpfr_set_d (escape_radius, escape_radius_sq * escape_radius_sq, MPFR_RNDN);
-
-  int iter = 0;
+  mpfr_t center_re, center_im, scale;
+  int x, y;
+  double radius;
+  int max_iter;
 
-  while (iter < max_iter)
-    {
-      if (generation != atomic_load (&g_generation))
-        return;
+  // Zooming onto the minibrot rather than only taking it as reference.
+  int zoom;
 
-      double z_x = mpfr_get_d (z_re, MPFR_RNDN);
-      double z_y = mpfr_get_d (z_im, MPFR_RNDN);
+  mpfr_t re, im;
+  struct floatexp size;
 
-      orbit_re[iter] = z_x;
-      orbit_im[iter] = z_y;
+  // 0 when there is none, -1 when the search was cleared or the generation
+  // it was started in ended before it was done.
+  int period;
+  int generation;
 
-      mpfr_mul (re_sqr, z_re, z_re, MPFR_RNDN);
-      mpfr_mul (im_sqr, z_im, z_im, MPFR_RNDN);
+  atomic_int done;
+};
 
-      mpfr_sub (temp_re, re_sqr, im_sqr, MPFR_RNDN);
+static struct nucleus_work *
+nucleus_work_create (mpfr_t center_re, mpfr_t center_im, mpfr_t scale, int x,
+                     int y, double radius, int zoom)
+{
+  struct nucleus_work *work = malloc (sizeof (struct nucleus_work));
 
-      mpfr_mul (temp_im, z_re, z_im, MPFR_RNDN);
-      mpfr_mul_ui (temp_im, temp_im, 2, MPFR_RNDN);
+  mpfr_init2 (work->center_re, mpfr_get_prec (center_re));
+  mpfr_init2 (work->center_im, mpfr_get_prec (center_im));
+  mpfr_init2 (work->scale, mpfr_get_prec (scale));
+  mpfr_inits2 (PRECISION_MIN, work->re, work->im, (mpfr_ptr)0);
 
-      mpfr_add (z_re, temp_re, center_re, MPFR_RNDN);
-      mpfr_add (z_im, temp_im, center_im, MPFR_RNDN);
+  mpfr_set (work->center_re, center_re, MPFR_RNDN);
+  mpfr_set (work->center_im, center_im, MPFR_RNDN);
+  mpfr_set (work->scale, scale, MPFR_RNDN);
 
-      mpfr_mul (re_sqr, z_re, z_re, MPFR_RNDN);
-      mpfr_mul (im_sqr, z_im, z_im, MPFR_RNDN);
-      mpfr_add (temp_re, re_sqr, im_sqr, MPFR_RNDN);
+  work->x = x;
+  work->y = y;
+  work->radius = radius;
+  work->max_iter = max_iter;
+  work->zoom = zoom;
+  work->period = 0;
+  work->generation = atomic_load (&g_generation);
 
-      if (mpfr_greater_p (temp_re, escape_radius))
-        break;
+  atomic_init (&work->done, 0);
 
-      iter++;
-    }
+  return work;
 }
 
-void
-render_compute_orbit_thread (void *argument)
+static void
+nucleus_work_destroy (struct nucleus_work *work)
 {
-  struct orbit_work *work = argument;
-
-  render_compute_orbit (work->center_re, work->center_im, work->orbit_re,
-                        work->orbit_im, work->generation);
-
-  if (work->generation != atomic_load (&g_generation))
-    goto clean;
-
-  pthread_mutex_lock (&pixels_mutex);
-  memcpy (g_orbit_re, work->orbit_re, max_iter * sizeof (double));
-  memcpy (g_orbit_im, work->orbit_im, max_iter * sizeof (double));
-  atomic_store (&g_orbit_amount, max_iter);
-  atomic_store (&g_orbit_ready, 1);
-  pthread_mutex_unlock (&pixels_mutex);
-
-clean:
-  free (work->orbit_re);
-  free (work->orbit_im);
-  mpfr_clears (work->center_re, work->center_im, (mpfr_ptr)0);
+  mpfr_clears (work->center_re, work->center_im, work->scale, work->re,
+               work->im, (mpfr_ptr)0);
   free (work);
 }
 
-struct render_work
+static void
+find_nucleus (void *argument)
 {
-  int x;
-  int y;
-  int tile;
-  int step;
-  int samples;
-  double scale;
-  double *orbit_re;
-  double *orbit_im;
-  int orbit_amount;
-  int generation;
-};
-
-void
-render_test (void *argument)
-{
-  struct render_work *work = argument;
-
-  /*
-  static const uint32_t palette[] = {
-    0xFF000000, 0xFF1A0A5E, 0xFF3D1F99, 0xFF5C44C3, 0xFF7C68E5,
-    0xFF9AA1F1, 0xFFB7BCFA, 0xFFDFE5FF, 0xFFB1C1D9, 0xFF7D91BF,
-    0xFF4C65A7, 0xFF1F3D88, 0xFF0A1A5E,
-  };
-  */
-
-  /*static const uint32_t palette[] = {
-    0xBCCAB3,
-    0x94A98F,
-    0x6E8B6C,
-    0x516A52,
-    0x3C4F3E,
-    0x2D3A2F,
-    0x1F2A22
-  };*/
-
-  static const uint32_t palette[]
-      = { 0xFF000000, 0xFF7877EE, 0xFF180719, 0xFFC5421C, 0xFF1D120B,
-          0xFF872E47, 0xFF181B0D, 0xFFF1E680, 0xFF111F18, 0xFFF0A28B,
-          0xFF0B041E, 0xFF6A57BD, 0xFF1D150E, 0xFF0C8C76, 0xFF0A061D,
-          0xFF32904D, 0xFF160018, 0xFF94BCF3, 0xFF042007, 0xFFE7920E,
-          0xFF0A0D14, 0xFFB89344, 0xFF0D1C03, 0xFFA9F898, 0xFF040022,
-          0xFF3E5330, 0xFF071516, 0xFF9861B8, 0xFF08030C, 0xFFF75CEB,
-          0xFF1F2010 };
-
-  /*
-  static const uint32_t palette[] = {
-    0xa9391f,
-    0xa68921,
-    0x59601f,
-    0x735615,
-    0x403f14,
-    0xad5621,
-    0x312d0c,
-    0xf7e847,
-    0xe3bb30,
-    0x513c0e,
-    0x8e7f21,
-    0x783411,
-    0x742013,
-    0xd5b15b,
-    0x90963d,
-    0x5b4f16,
-    0x816f1d,
-    0x54210b,
-    0x88765f,
-    0xccb92e,
-    0x140f05,
-    0x814c42,
-    0xc0a87c,
-    0x341f07,
-    0x53110b,
-    0xf9eb83,
-    0x5b4235,
-    0x7a5a2e,
-    0x170404,
-    0x8f5615,
-    0x3f2a1e,
-    0x512c0b,
-    0xc98a19,
-    0x64390e,
-    0x3f1c07,
-    0x241c06,
-    0x345e10,
-    0x432d2c,
-    0x241405,
-    0x291f1c,
-    0x3e0b06,
-    0xbadc46,
-    // 0xac446c,
-    0x0b1405,
-  };
-  */
-
-  static const int palette_size = sizeof (palette) / sizeof (palette[0]);
-
-  // static const int samples = 16;
-
-  const int samples = work->samples;
-
-  const double escape_radius_sq = ESCAPE_RADIUS * ESCAPE_RADIUS;
-
-  double scale = work->scale;
-
-  for (int delta_y = 0; delta_y < work->tile; delta_y += work->step)
-    {
-      int y = work->y + delta_y;
-
-      if (y >= HEIGHT)
-        break;
-
-      for (int delta_x = 0; delta_x < work->tile; delta_x += work->step)
-        {
-          if (work->generation != atomic_load (&g_generation))
-            goto clean;
-
-          int x = work->x + delta_x;
-
-          if (x >= WIDTH)
-            break;
-
-          double dx = (x - WIDTH / 2.0) * scale;
-          double dy = (y - HEIGHT / 2.0) * scale;
-
-          double delta_c_re = dx;
-          double delta_c_im = dy;
-          double delta_z_re = 0.0;
-          double delta_z_im = 0.0;
-
-          // int iter = 0;
-          int iter;
-          double zn2;
-
-          pthread_mutex_lock (&pixels_done_mutex);
-          iter = pixels_done[y * WIDTH + x];
-          pthread_mutex_unlock (&pixels_done_mutex);
-
-          if (iter == -1)
-            {
-              int iter_orbit = 0;
-
-              while (iter < max_iter)
-                {
-                  double ref_re = work->orbit_re[iter_orbit];
-                  double ref_im = work->orbit_im[iter_orbit];
-
-                  double temp_re
-                      = 2.0 * (ref_re * delta_z_re - ref_im * delta_z_im);
-                  double temp_im
-                      = 2.0 * (ref_re * delta_z_im + ref_im * delta_z_re);
+  struct nucleus_work *work = argument;
 
-                  double dz2_re
-                      = delta_z_re * delta_z_re - delta_z_im * delta_z_im;
-                  double dz2_im = 2.0 * delta_z_re * delta_z_im;
+  mpfr_t r;
+  mpfr_init2 (r, mpfr_get_prec (work->scale));
+  mpfr_mul_d (r, work->scale, work->radius, MPFR_RNDN);
 
-                  delta_z_re = temp_re + dz2_re + delta_c_re;
-                  delta_z_im = temp_im + dz2_im + delta_c_im;
+  mpfr_set_prec (work->re, mpfr_get_prec (work->center_re));
+  mpfr_set_prec (work->im, mpfr_get_prec (work->center_im));
 
-                  if (iter_orbit + 1 > work->orbit_amount - 1)
-                    {
-                      iter++;
-                      continue;
-                    }
-                  else
-                    iter_orbit++;
-
-                  double z_re = work->orbit_re[iter_orbit] + delta_z_re;
-                  double z_im = work->orbit_im[iter_orbit] + delta_z_im;
-
-                  if (z_re * z_re + z_im * z_im > escape_radius_sq)
-                    break;
-
-                  zn2 = z_re * z_re + z_im * z_im;
-
-                  if ((delta_z_re * delta_z_re + delta_z_im * delta_z_im)
-                      > (z_re * z_re + z_im * z_im))
-                    {
-                      delta_z_re = z_re;
-                      delta_z_im = z_im;
-                      iter_orbit = 0;
-                    }
-
-                  iter++;
-                }
-            }
-
-          /*
-          int iter_orbit = 0;
-
-          while (iter < max_iter)
-            {
-              double ref_re = work->orbit_re[iter_orbit];
-              double ref_im = work->orbit_im[iter_orbit];
-
-              double temp_re
-                  = 2.0 * (ref_re * delta_z_re - ref_im * delta_z_im);
-              double temp_im
-                  = 2.0 * (ref_re * delta_z_im + ref_im * delta_z_re);
-
-              double dz2_re = delta_z_re * delta_z_re - delta_z_im * delta_z_im;
-              double dz2_im = 2.0 * delta_z_re * delta_z_im;
-
-              delta_z_re = temp_re + dz2_re + delta_c_re;
-              delta_z_im = temp_im + dz2_im + delta_c_im;
-
-              iter_orbit++;
+  mpfr_mul_d (work->re, work->scale, work->x - WIDTH / 2.0, MPFR_RNDN);
+  mpfr_add (work->re, work->re, work->center_re, MPFR_RNDN);
+  mpfr_mul_d (work->im, work->scale, work->y - HEIGHT / 2.0, MPFR_RNDN);
+  mpfr_add (work->im, work->im, work->center_im, MPFR_RNDN);
 
-              double z_re = work->orbit_re[iter_orbit] + delta_z_re;
-              double z_im = work->orbit_im[iter_orbit] + delta_z_im;
-
-              if (z_re * z_re + z_im * z_im > escape_radius_sq)
-                break;
-
-              if ((delta_z_re * delta_z_re + delta_z_im * delta_z_im)
-                  > (z_re * z_re + z_im * z_im))
-                {
-                  delta_z_re = z_re;
-                  delta_z_im = z_im;
-                  iter_orbit = 0;
-                }
-
-              iter++;
-            }
-          */
+  work->period = nucleus_find (work->re, work->im, r, work->max_iter,
+                               &work->size, work->generation);
 
-          uint32_t color;
+  mpfr_clear (r);
 
-          if (iter == max_iter)
-            color = 0xFF000000;
-          else
-            {
-              double nu = iter + 1 - log2 (log2 (sqrt (zn2)));
-
-              double freq = 0.1;
-              double t = nu * freq;
-
-              t = t - floor (t / palette_size) * palette_size;
-
-              int idx = (int)t;
-              double frac = t - idx;
-
-              uint32_t c1 = palette[idx % palette_size];
-              uint32_t c2 = palette[(idx + 1) % palette_size];
-
-              color = interpolate_color (c1, c2, frac);
-            }
+  atomic_store (&work->done, 1);
+}
 
-          pthread_mutex_lock (&pixels_mutex);
+static void
+find_nucleus_drop (void *argument)
+{
+  struct nucleus_work *work = argument;
 
-          for (int step_y = 0; step_y < work->step; ++step_y)
-            {
-              if (y + step_y >= HEIGHT)
-                break;
+  work->period = -1;
+  atomic_store (&work->done, 1);
+}
 
-              for (int step_x = 0; step_x < work->step; ++step_x)
-                {
-                  if (x + step_x >= WIDTH)
-                    break;
+// Moves the view to 2^zoom times its pixel spacing, centered shift pixels
+// away from where it was, as render_reproject takes it.
+static void
+move_view (mpfr_t center_re, mpfr_t center_im, mpfr_t scale, int zoom,
+           int shift_x, int shift_y)
+{
+  mpfr_t temp;
+  mpfr_init2 (temp, mpfr_get_prec (scale) + 32);
 
-                  pixels[(y + step_y) * WIDTH + (x + step_x)] = color;
-                }
-            }
+  // The center follows the depth of the new view.
+  mpfr_mul_2si (temp, scale, zoom, MPFR_RNDN);
+  int precision = render_precision (temp);
 
-          pthread_mutex_unlock (&pixels_mutex);
-        }
+  if (precision > mpfr_get_prec (center_re))
+    {
+      mpfr_prec_round (center_re, precision, MPFR_RNDN);
+      mpfr_prec_round (center_im, precision, MPFR_RNDN);
     }
 
-clean:
-  free (work);
-}
+  mpfr_mul_si (temp, scale, shift_x, MPFR_RNDN);
+  mpfr_add (center_re, center_re, temp, MPFR_RNDN);
+  mpfr_mul_si (temp, scale, shift_y, MPFR_RNDN);
+  mpfr_add (center_im, center_im, temp, MPFR_RNDN);
 
-SDL_Texture *
-render_text (SDL_Renderer *renderer, TTF_Font *font, const char *text,
-             SDL_Color color, int *out_width, int *out_height)
-{
-  SDL_Surface *surface = TTF_RenderText_Blended (font, text, color);
-  SDL_Texture *texture = SDL_CreateTextureFromSurface (renderer, surface);
-
-  *out_width = surface->w;
-  *out_height = surface->h;
+  mpfr_mul_2si (scale, scale, zoom, MPFR_RNDN);
 
-  SDL_FreeSurface (surface);
-  return texture;
+  mpfr_clear (temp);
 }
 
 int
@@ -438,24 +183,28 @@ main (void)
   texture = SDL_CreateTexture (renderer, SDL_PIXELFORMAT_ARGB8888,
                                SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
 
-  pthread_mutex_init (&pixels_mutex, NULL);
-  pthread_mutex_init (&pixels_done_mutex, NULL);
+  render_init (WIDTH, HEIGHT);
+
+  g_orbit_cache = orbit_cache_create (NULL, ORBIT_CACHE_LIMIT);
 
   mpfr_t center_re, center_im, scale;
-  mpfr_inits2 (PRECISION_BITS, center_re, center_im, scale, (mpfr_ptr)0);
+  mpfr_init2 (scale, 64);
 
   // mpfr_set_str (center_re, "-1.985919359960978684453223192193245964271429062666543775386350473746671904875957384480865222226476313620202583817469956970852638701807169521470642552907749357586890444572682637018316051868610025537670443440689026879454018393007724172657727729167322909246742879556044470059151604019800566771833620747885755006452251", 10, MPFR_RNDN);
 
   // mpfr_set_str (center_im, "-0.00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000678212430620458622491305267427423408887673261336189549931937020270202016632357548903502696479563088407759416804344221703369528195270240611711018734136689857005888", 10, MPFR_RNDN);
 
+  mpfr_set_d (scale, 0.005, MPFR_RNDN);
+
+  mpfr_inits2 (render_precision (scale), center_re, center_im, (mpfr_ptr)0);
+
   mpfr_set_d (center_re, -0.75, MPFR_RNDN);
   mpfr_set_d (center_im, 0.00, MPFR_RNDN);
-  mpfr_set_d (scale, 0.005, MPFR_RNDN);
 
   // double scale = 0.005;
 
-  g_orbit_re = calloc (max_iter, sizeof (double));
-  g_orbit_im = calloc (max_iter, sizeof (double));
+  g_orbit_re = calloc (max_iter + 1, sizeof (double));
+  g_orbit_im = calloc (max_iter + 1, sizeof (double));
 
   // double *orbit_re = calloc (max_iter, sizeof (double));
   // double *orbit_im = calloc (max_iter, sizeof (double));
@@ -464,8 +213,17 @@ main (void)
 
   pool = thread_pool_create (12, 32768 * 8);
 
+  // Everything enqueued for the frame on screen, so its completion is
+  // known.
+  struct thread_pool_group *frame = thread_pool_group_create ();
+
   int redraw = 1;
 
+  // Set instead of redraw when the new view starts from the last one, see
+  // move_view.
+  int reuse = 0;
+  int reuse_zoom = 0, reuse_x = 0, reuse_y = 0;
+
   TTF_Font *font = TTF_OpenFont ("font.ttf", 24);
   SDL_Color color = { 255, 255, 255, 255 };
 
@@ -481,16 +239,20 @@ main (void)
   }*/
 
   int done = 0;
+  int supersampled = 0;
   int computing_orbit = 0;
-  uint32_t start_orbit;
+  uint32_t start_orbit = SDL_GetTicks ();
 
   double zoom_scale = 1.0;
   double zoom_x = 0.0, zoom_y = 0.0;
 
-  uint32_t start, end;
+  uint32_t start = start_orbit, end;
 
   uint8_t show_information = 0;
 
+  // The minibrot being looked for, if any, see find_nucleus.
+  struct nucleus_work *nucleus = NULL;
+
   while (1)
     {
       SDL_Event event;
@@ -509,16 +271,40 @@ main (void)
               case SDLK_PAGEUP:
                 atomic_fetch_add (&g_generation, 1);
                 thread_pool_clear (pool);
+                thread_pool_wait (pool);
                 max_iter *= 2;
                 printf ("max_iter=%d\n", max_iter);
                 // orbit_re = realloc (orbit_re, max_iter * sizeof (double));
                 // orbit_im = realloc (orbit_im, max_iter * sizeof (double));
-                g_orbit_re = realloc (g_orbit_re, max_iter * sizeof (double));
-                g_orbit_im = realloc (g_orbit_im, max_iter * sizeof (double));
+                g_orbit_re = realloc (g_orbit_re,
+                                      (max_iter + 1) * sizeof (double));
+                g_orbit_im = realloc (g_orbit_im,
+                                      (max_iter + 1) * sizeof (double));
+
+                // Without a finished orbit there is nothing to resume.
+                if (redraw || reuse
+                    || !render_enqueue_extend (pool, frame, max_iter))
+                  {
+                    redraw = 1;
+                    break;
+                  }
+
+                done = 0;
+                supersampled = 0;
+                computing_orbit = 1;
+                start_orbit = SDL_GetTicks ();
+                atomic_store (&g_orbit_ready, 0);
+
+                // The last frame stays on screen, only the pixels that hit
+                // the old max_iter are carried on.
+                render_resume ();
+                render_enqueue_pass (pool, frame, 1, center_re, center_im,
+                                     scale, max_iter);
                 break;
               case SDLK_PAGEDOWN:
                 atomic_fetch_add (&g_generation, 1);
                 thread_pool_clear (pool);
+                thread_pool_wait (pool);
                 max_iter /= 2;
 
                 if (max_iter <= 64)
@@ -527,20 +313,137 @@ main (void)
                 printf ("max_iter=%d\n", max_iter);
                 // orbit_re = realloc (orbit_re, max_iter * sizeof (double));
                 // orbit_im = realloc (orbit_im, max_iter * sizeof (double));
-                g_orbit_re = realloc (g_orbit_re, max_iter * sizeof (double));
-                g_orbit_im = realloc (g_orbit_im, max_iter * sizeof (double));
+                g_orbit_re = realloc (g_orbit_re,
+                                      (max_iter + 1) * sizeof (double));
+                g_orbit_im = realloc (g_orbit_im,
+                                      (max_iter + 1) * sizeof (double));
+                redraw = 1;
+                break;
+              case SDLK_a:
+                samples = samples == 1 ? 8 : 1;
+                printf ("samples=%d\n", samples);
+
+                // Edges already supersampled are only dropped by a redraw.
+                if (samples == 1)
+                  redraw = 1;
+                else
+                  done = 0;
+                break;
+              case SDLK_p:
+              case SDLK_LEFTBRACKET:
+              case SDLK_RIGHTBRACKET:
+              case SDLK_COMMA:
+              case SDLK_PERIOD:
+                // Recolored from the iterations in place, nothing is
+                // computed again.
+                if (event.key.keysym.sym == SDLK_p)
+                  palette++;
+                else if (event.key.keysym.sym == SDLK_LEFTBRACKET)
+                  frequency /= 1.25;
+                else if (event.key.keysym.sym == SDLK_RIGHTBRACKET)
+                  frequency *= 1.25;
+                else if (event.key.keysym.sym == SDLK_COMMA)
+                  offset -= 0.5;
+                else
+                  offset += 0.5;
+
+                printf ("palette=%d frequency=%.3g offset=%.1f\n", palette,
+                        frequency, offset);
+
+                render_set_coloring (palette, frequency, offset);
+                render_enqueue_color (pool, NULL);
+                break;
+              case SDLK_n:
+              case SDLK_m:
+                {
+                  if (nucleus)
+                    {
+                      printf ("still looking for a minibrot\n");
+                      break;
+                    }
+
+                  // The frame is redrawn against the minibrot anyway, the
+                  // pool is left to the search meanwhile.
+                  atomic_fetch_add (&g_generation, 1);
+                  thread_pool_clear (pool);
+                  thread_pool_wait (pool);
+
+                  int mouse_x, mouse_y;
+                  SDL_GetMouseState (&mouse_x, &mouse_y);
+
+                  // N takes the minibrot of the whole view as reference, M
+                  // zooms onto the one nearest the cursor.
+                  if (event.key.keysym.sym == SDLK_m)
+                    nucleus = nucleus_work_create (center_re, center_im,
+                                                   scale, mouse_x, mouse_y,
+                                                   HEIGHT / 8.0, 1);
+                  else
+                    nucleus = nucleus_work_create (
+                        center_re, center_im, scale, WIDTH / 2, HEIGHT / 2,
+                        hypot (WIDTH / 2.0, HEIGHT / 2.0), 0);
+
+                  thread_pool_enqueue (pool, NULL, find_nucleus,
+                                       find_nucleus_drop, nucleus);
+                }
                 break;
               }
             break;
           case SDL_MOUSEBUTTONDOWN:
             if (event.button.button == SDL_BUTTON_RIGHT)
-              redraw = 1;
+              {
+                // The clicked pixel becomes the center.
+                reuse_zoom = 0;
+                reuse_x = event.button.x - WIDTH / 2;
+                reuse_y = event.button.y - HEIGHT / 2;
+
+                move_view (center_re, center_im, scale, reuse_zoom, reuse_x,
+                           reuse_y);
+                render_set_focus (WIDTH / 2, HEIGHT / 2);
+
+                if (redraw || reuse)
+                  redraw = 1;
+                else
+                  reuse = 1;
+              }
             break;
           case SDL_MOUSEWHEEL:
             {
               int mouse_x, mouse_y;
               SDL_GetMouseState (&mouse_x, &mouse_y);
 
+              // The point under the cursor stays put, the new view is
+              // rendered outwards from it.
+              render_set_focus (mouse_x, mouse_y);
+
+              // With shift, exactly 2x around the pixel under the cursor.
+              // Zooming in keeps it within a pixel, so the two views share
+              // every other pixel.
+              if (SDL_GetModState () & KMOD_SHIFT)
+                {
+                  reuse_zoom = event.wheel.y > 0 ? -1 : 1;
+
+                  if (reuse_zoom > 0)
+                    {
+                      reuse_x = WIDTH / 2 - mouse_x;
+                      reuse_y = HEIGHT / 2 - mouse_y;
+                    }
+                  else
+                    {
+                      reuse_x = (mouse_x - WIDTH / 2) / 2;
+                      reuse_y = (mouse_y - HEIGHT / 2) / 2;
+                    }
+
+                  move_view (center_re, center_im, scale, reuse_zoom,
+                             reuse_x, reuse_y);
+
+                  if (redraw || reuse)
+                    redraw = 1;
+                  else
+                    reuse = 1;
+
+                  break;
+                }
+
               double zoom_value = (event.wheel.y > 0) ? 0.75 : 1.25;
               // zoom_scale /= zoom_value;
 
@@ -559,13 +462,23 @@ main (void)
               mpfr_t re_before, im_before;
               mpfr_t tmp1, tmp2;
 
-              mpfr_inits2 (PRECISION_BITS, old_scale, new_scale, re_before,
-                           im_before, tmp1, tmp2, (mpfr_ptr)0);
+              mpfr_init2 (old_scale, mpfr_get_prec (scale));
+              mpfr_init2 (new_scale, mpfr_get_prec (scale));
 
               mpfr_set (old_scale, scale, MPFR_RNDN);
+              mpfr_mul_d (new_scale, scale, zoom_value, MPFR_RNDN);
+
+              // The center follows the depth of the new view.
+              int precision = render_precision (new_scale);
+
+              if (precision > mpfr_get_prec (center_re))
+                {
+                  mpfr_prec_round (center_re, precision, MPFR_RNDN);
+                  mpfr_prec_round (center_im, precision, MPFR_RNDN);
+                }
 
-              mpfr_set_d (tmp1, zoom_value, MPFR_RNDN);
-              mpfr_mul (new_scale, scale, tmp1, MPFR_RNDN);
+              mpfr_inits2 (mpfr_get_prec (center_re), re_before, im_before,
+                           tmp1, tmp2, (mpfr_ptr)0);
 
               mpfr_set_d (tmp1, (double)(mouse_x - WIDTH / 2.0), MPFR_RNDN);
               mpfr_mul (tmp2, tmp1, old_scale, MPFR_RNDN);
@@ -593,9 +506,52 @@ main (void)
             break;
           }
 
-      if (redraw)
+      // The minibrot search is done, see find_nucleus.
+      if (nucleus && atomic_load (&nucleus->done))
+        {
+          if (nucleus->period > 0)
+            {
+              printf ("period %d size %.3f*2^%ld\n", nucleus->period,
+                      nucleus->size.mant, nucleus->size.exp);
+
+              // A frame may have been started meanwhile.
+              atomic_fetch_add (&g_generation, 1);
+              thread_pool_clear (pool);
+              thread_pool_wait (pool);
+
+              render_set_reference (nucleus->re, nucleus->im);
+            }
+          else if (nucleus->period == 0)
+            printf ("no minibrot within max_iter\n");
+
+          if (nucleus->period > 0 && nucleus->zoom)
+            {
+              // The minibrot is about 2.5 times its size across, it takes
+              // up half the height.
+              mpfr_set_d (scale, 5.0 * nucleus->size.mant / HEIGHT,
+                          MPFR_RNDN);
+              mpfr_mul_2si (scale, scale, nucleus->size.exp, MPFR_RNDN);
+
+              mpfr_set_prec (center_re, mpfr_get_prec (nucleus->re));
+              mpfr_set_prec (center_im, mpfr_get_prec (nucleus->im));
+              mpfr_set (center_re, nucleus->re, MPFR_RNDN);
+              mpfr_set (center_im, nucleus->im, MPFR_RNDN);
+
+              render_set_focus (WIDTH / 2, HEIGHT / 2);
+            }
+
+          // A cleared search went with a redraw already.
+          if (nucleus->period >= 0)
+            redraw = 1;
+
+          nucleus_work_destroy (nucleus);
+          nucleus = NULL;
+        }
+
+      if (redraw || reuse)
         {
           done = 0;
+          supersampled = 0;
           computing_orbit = 1;
           start_orbit = SDL_GetTicks ();
           // printf ("Computing orbit...\n");
@@ -603,28 +559,34 @@ main (void)
 
           atomic_fetch_add (&g_generation, 1);
           thread_pool_clear (pool);
+          thread_pool_wait (pool);
 
-          struct orbit_work *work;
+          // Only the pixels the last frame does not have are left to the
+          // passes.
+          if (redraw)
+            render_reset ();
+          else
+            render_reproject (reuse_zoom, reuse_x, reuse_y);
 
-          work = calloc (1, sizeof (struct orbit_work));
-          mpfr_inits2 (PRECISION_BITS, work->center_re, work->center_im,
-                       (mpfr_ptr)0);
-          mpfr_set (work->center_re, center_re, MPFR_RNDN);
-          mpfr_set (work->center_im, center_im, MPFR_RNDN);
+          // The passes follow the orbit as it comes in.
+          render_enqueue_orbit (pool, frame, center_re, center_im, scale,
+                                max_iter);
 
-          work->scale = mpfr_get_d (scale, MPFR_RNDN);
-          work->generation = atomic_load (&g_generation);
-          work->orbit_re = calloc (max_iter, sizeof (double));
-          work->orbit_im = calloc (max_iter, sizeof (double));
+          const int steps[] = { 16, 4, 1 };
+          const int steps_amount = sizeof steps / sizeof (int);
 
-          thread_pool_enqueue (pool, render_compute_orbit_thread, work);
+          // for (int step = 64; step != 1; step = 1)
+          for (int i = 0; i < steps_amount; ++i)
+            render_enqueue_pass (pool, frame, steps[i], center_re, center_im,
+                                 scale, max_iter);
 
           redraw = 0;
+          reuse = 0;
 
           /*
           start = SDL_GetTicks ();
 
-          uint32_t start_orbit = SDL_GetTicks ();
+          start_orbit = SDL_GetTicks ();
           render_compute_orbit (center_re, center_im, orbit_re, orbit_im,
           atomic_load (&g_generation)); uint32_t end_orbit = SDL_GetTicks ();
           time_orbit = end_orbit - start_orbit;
@@ -662,92 +624,30 @@ main (void)
 
       if (atomic_load (&g_orbit_ready))
         {
-          for (size_t i = 0; i < WIDTH * HEIGHT; ++i)
-            pixels[i] = 0;
-
           start = SDL_GetTicks ();
 
           computing_orbit = 0;
-          // printf ("Computing image...\n");
-          atomic_fetch_add (&g_generation, 1);
-          thread_pool_clear (pool);
-
-          for (size_t i = 0; i < WIDTH * HEIGHT; ++i)
-            pixels_done[i] = -1;
-
-          const int steps[] = { 16, 4, 1 };
-          const int steps_amount = sizeof steps / sizeof (int);
-
-          // for (int step = 64; step != 1; step = 1)
-          for (int i = 0; i < steps_amount; ++i)
-            {
-              int step = steps[i];
-
-              int tile = step;
-              if (tile < 8)
-                tile = 8;
-
-              for (int y = 0; y < HEIGHT; y += tile)
-                for (int x = 0; x < WIDTH; x += tile)
-                  {
-                    struct render_work *work;
-                    work = calloc (1, sizeof (struct render_work));
-
-                    work->x = x;
-                    work->y = y;
-
-                    work->tile = tile;
-                    work->step = step;
-                    work->samples = 1;
-
-                    work->orbit_re = g_orbit_re;
-                    work->orbit_im = g_orbit_im;
-                    work->orbit_amount = atomic_load (&g_orbit_amount);
-
-                    work->scale = mpfr_get_d (scale, MPFR_RNDN);
-
-                    work->generation = atomic_load (&g_generation);
-
-                    thread_pool_enqueue (pool, render_test, work);
-                  }
-            }
-
           atomic_store (&g_orbit_ready, 0);
         }
 
-      if (!done && !computing_orbit
-          && thread_pool_get_threads_active (pool) == 0)
+      // The frame cleared for a minibrot search is not complete.
+      if (!done && !computing_orbit && !nucleus
+          && thread_pool_group_poll (frame))
         {
           done = 1;
 
           end = SDL_GetTicks ();
 
-          printf ("%dms %.2e\n", end - start, mpfr_get_d (scale, MPFR_RNDN));
-
-          /*
-          for (int y = 0; y < HEIGHT; y += 8)
-            for (int x = 0; x < WIDTH; x += 8)
-              {
-                struct render_work *work;
-                work = calloc (1, sizeof (struct render_work));
-
-                work->x = x;
-                work->y = y;
-
-                work->tile = 8;
-                work->step = 1;
-                work->samples = 8;
-
-                work->orbit_re = g_orbit_re;
-                work->orbit_im = g_orbit_im;
+          printf ("%dms (orbit %dms) %.2e\n", end - start_orbit,
+                  start - start_orbit, mpfr_get_d (scale, MPFR_RNDN));
 
-                work->scale = mpfr_get_d (scale, MPFR_RNDN);
-
-                work->generation = atomic_load (&g_generation);
-
-                thread_pool_enqueue (pool, render_test, work);
-              }
-              */
+          if (samples > 1 && !supersampled)
+            {
+              render_enqueue_supersample (pool, frame, samples, center_re,
+                                          center_im, scale, max_iter);
+              supersampled = 1;
+              done = 0;
+            }
 
           // thread_pool_enqueue (pool, apply_box_blur, NULL);
         }
@@ -756,7 +656,20 @@ main (void)
 
       SDL_SetRenderDrawColor (renderer, 66, 61, 57, 255);
       SDL_RenderClear (renderer);
-      SDL_UpdateTexture (texture, NULL, pixels, WIDTH * sizeof (uint32_t));
+
+      // Only what the tiles painted since the last frame is uploaded.
+      struct render_rect dirty[256];
+      int dirty_amount = render_take_dirty (dirty, 256);
+
+      for (int i = 0; i < dirty_amount; ++i)
+        {
+          SDL_Rect rect = { dirty[i].x, dirty[i].y, dirty[i].width,
+                            dirty[i].height };
+
+          SDL_UpdateTexture (texture, &rect,
+                             pixels + (size_t)rect.y * WIDTH + rect.x,
+                             WIDTH * sizeof (uint32_t));
+        }
 
       if (computing_orbit)
         {
@@ -816,14 +729,23 @@ main (void)
     }
 
 quit:
+  atomic_fetch_add (&g_generation, 1);
+  thread_pool_clear (pool);
+  thread_pool_destroy (pool);
+  thread_pool_group_destroy (frame);
+
+  if (nucleus)
+    nucleus_work_destroy (nucleus);
+
   SDL_DestroyTexture (texture);
   SDL_DestroyRenderer (renderer);
   SDL_DestroyWindow (window);
 
   mpfr_clears (center_re, center_im, (mpfr_ptr)0);
 
-  pthread_mutex_destroy (&pixels_mutex);
-  pthread_mutex_destroy (&pixels_done_mutex);
+  orbit_cache_destroy (g_orbit_cache);
+
+  render_quit ();
 
   SDL_Quit ();
 
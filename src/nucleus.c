@@ -0,0 +1,356 @@
+#include "nucleus.h"
+#include "render.h"
+#include <math.h>
+
+
+// Newton steps allowed per refinement; a converging one doubles the correct
+// bits with each step.
+#define NUCLEUS_STEPS 64
+
+// Radii from where it was looked for that a nucleus may still lie.  The disk
+// is only followed to first order, which misses some nuclei by a few radii.
+#define NUCLEUS_DISTANCE_MAX 8.0
+
+
+// Period of the lowest period nucleus within about radius of center, or 0
+// when there is none up to max_period or the generation changed.  The disk
+// of that radius is followed to first order, as z_n of the center with
+// radius r |dz_n/dc|; the first n for which it takes in 0 is the period.
+int
+nucleus_period (mpfr_t center_re, mpfr_t center_im, mpfr_t radius,
+                int max_period, int generation)
+{
+  mpfr_t z_re, z_im, sqr_re, sqr_im, norm;
+  mpfr_inits2 (mpfr_get_prec (center_re), z_re, z_im, sqr_re, sqr_im, norm,
+               (mpfr_ptr)0);
+
+  mpfr_set_d (z_re, 0.0, MPFR_RNDN);
+  mpfr_set_d (z_im, 0.0, MPFR_RNDN);
+  mpfr_set_d (sqr_re, 0.0, MPFR_RNDN);
+  mpfr_set_d (sqr_im, 0.0, MPFR_RNDN);
+
+  // Compared in log2, |dz| soon leaves the range of a double.
+  long radius_exp;
+  double radius_mant = mpfr_get_d_2exp (&radius_exp, radius, MPFR_RNDN);
+  double radius_log = log2 (radius_mant) + radius_exp;
+
+  struct floatexp_complex dz = { 0.0, 0.0, 0 };
+  int period = 0;
+
+  for (int n = 1; n <= max_period; ++n)
+    {
+      if (generation != atomic_load (&g_generation))
+        break;
+
+      // dz = 2 z dz + 1, with z before the step.
+      double z_x = mpfr_get_d (z_re, MPFR_RNDN);
+      double z_y = mpfr_get_d (z_im, MPFR_RNDN);
+
+      double dz_re = 2.0 * (z_x * dz.re - z_y * dz.im);
+      double dz_im = 2.0 * (z_x * dz.im + z_y * dz.re);
+
+      dz.re = dz_re + ldexp (1.0, -dz.exp);
+      dz.im = dz_im;
+      floatexp_complex_normalize (&dz);
+
+      mpfr_mul (z_im, z_re, z_im, MPFR_RNDN);
+      mpfr_mul_2ui (z_im, z_im, 1, MPFR_RNDN);
+      mpfr_add (z_im, z_im, center_im, MPFR_RNDN);
+
+      mpfr_sub (z_re, sqr_re, sqr_im, MPFR_RNDN);
+      mpfr_add (z_re, z_re, center_re, MPFR_RNDN);
+
+      mpfr_sqr (sqr_re, z_re, MPFR_RNDN);
+      mpfr_sqr (sqr_im, z_im, MPFR_RNDN);
+      mpfr_add (norm, sqr_re, sqr_im, MPFR_RNDN);
+
+      if (mpfr_zero_p (norm))
+        {
+          period = n;
+          break;
+        }
+
+      if (mpfr_cmp_d (norm, 4.0) > 0)
+        break;
+
+      long norm_exp;
+      double norm_mant = mpfr_get_d_2exp (&norm_exp, norm, MPFR_RNDN);
+
+      double z_log = 0.5 * (log2 (norm_mant) + norm_exp);
+      double dz_log = log2 (hypot (dz.re, dz.im)) + dz.exp;
+
+      if (z_log < radius_log + dz_log)
+        {
+          period = n;
+          break;
+        }
+    }
+
+  mpfr_clears (z_re, z_im, sqr_re, sqr_im, norm, (mpfr_ptr)0);
+
+  return period;
+}
+
+
+// Newton's method on z_period(c) = 0 in the precision of c, for at most
+// steps steps.  Returns 1 once a step no longer moves c at that precision,
+// 0 when it did not settle or the generation changed.
+int
+nucleus_refine (mpfr_t c_re, mpfr_t c_im, int period, int steps,
+                int generation)
+{
+  mpfr_prec_t precision = mpfr_get_prec (c_re);
+
+  mpfr_t z_re, z_im, dz_re, dz_im, t_re, t_im, norm;
+  mpfr_inits2 (precision, z_re, z_im, dz_re, dz_im, t_re, t_im, norm,
+               (mpfr_ptr)0);
+
+  int converged = 0;
+  int stopped = 0;
+
+  for (int step = 0; step < steps && !converged && !stopped; ++step)
+    {
+      mpfr_set_d (z_re, 0.0, MPFR_RNDN);
+      mpfr_set_d (z_im, 0.0, MPFR_RNDN);
+      mpfr_set_d (dz_re, 0.0, MPFR_RNDN);
+      mpfr_set_d (dz_im, 0.0, MPFR_RNDN);
+
+      for (int i = 0; i < period; ++i)
+        {
+          if (generation != atomic_load (&g_generation))
+            {
+              stopped = 1;
+              break;
+            }
+
+          // dz = 2 z dz + 1
+          mpfr_fmms (t_re, z_re, dz_re, z_im, dz_im, MPFR_RNDN);
+          mpfr_fmma (t_im, z_re, dz_im, z_im, dz_re, MPFR_RNDN);
+
+          mpfr_mul_2ui (dz_re, t_re, 1, MPFR_RNDN);
+          mpfr_add_d (dz_re, dz_re, 1.0, MPFR_RNDN);
+          mpfr_mul_2ui (dz_im, t_im, 1, MPFR_RNDN);
+
+          // z = z^2 + c
+          mpfr_fmms (t_re, z_re, z_re, z_im, z_im, MPFR_RNDN);
+
+          mpfr_mul (z_im, z_re, z_im, MPFR_RNDN);
+          mpfr_mul_2ui (z_im, z_im, 1, MPFR_RNDN);
+          mpfr_add (z_im, z_im, c_im, MPFR_RNDN);
+
+          mpfr_add (z_re, t_re, c_re, MPFR_RNDN);
+        }
+
+      if (stopped)
+        break;
+
+      // c -= z / dz, as z conj(dz) / |dz|^2.
+      mpfr_fmma (norm, dz_re, dz_re, dz_im, dz_im, MPFR_RNDN);
+
+      if (mpfr_zero_p (norm) || !mpfr_number_p (norm))
+        break;
+
+      mpfr_fmma (t_re, z_re, dz_re, z_im, dz_im, MPFR_RNDN);
+      mpfr_fmms (t_im, z_im, dz_re, z_re, dz_im, MPFR_RNDN);
+
+      mpfr_div (t_re, t_re, norm, MPFR_RNDN);
+      mpfr_div (t_im, t_im, norm, MPFR_RNDN);
+
+      mpfr_sub (c_re, c_re, t_re, MPFR_RNDN);
+      mpfr_sub (c_im, c_im, t_im, MPFR_RNDN);
+
+      // Nuclei lie within |c| <= 2, a few ulps there is as good as it gets.
+      converged = (mpfr_zero_p (t_re) || mpfr_get_exp (t_re) < 8 - precision)
+                  && (mpfr_zero_p (t_im)
+                      || mpfr_get_exp (t_im) < 8 - precision);
+    }
+
+  mpfr_clears (z_re, z_im, dz_re, dz_im, t_re, t_im, norm, (mpfr_ptr)0);
+
+  return converged && mpfr_number_p (c_re) && mpfr_number_p (c_im);
+}
+
+
+// Smallest divisor of period that c is a nucleus of as well, since Newton's
+// method for a period settles on the nuclei of its divisors too.  Once the
+// generation changed the period is left as it is.
+static int
+nucleus_exact_period (mpfr_t c_re, mpfr_t c_im, int period, int generation)
+{
+  mpfr_prec_t precision = mpfr_get_prec (c_re);
+
+  mpfr_t z_re, z_im, sqr_re, sqr_im;
+  mpfr_inits2 (precision, z_re, z_im, sqr_re, sqr_im, (mpfr_ptr)0);
+
+  mpfr_set_d (z_re, 0.0, MPFR_RNDN);
+  mpfr_set_d (z_im, 0.0, MPFR_RNDN);
+
+  int exact = period;
+
+  for (int q = 1; q < period; ++q)
+    {
+      if (generation != atomic_load (&g_generation))
+        break;
+
+      mpfr_sqr (sqr_re, z_re, MPFR_RNDN);
+      mpfr_sqr (sqr_im, z_im, MPFR_RNDN);
+
+      mpfr_mul (z_im, z_re, z_im, MPFR_RNDN);
+      mpfr_mul_2ui (z_im, z_im, 1, MPFR_RNDN);
+      mpfr_add (z_im, z_im, c_im, MPFR_RNDN);
+
+      mpfr_sub (z_re, sqr_re, sqr_im, MPFR_RNDN);
+      mpfr_add (z_re, z_re, c_re, MPFR_RNDN);
+
+      // Back at 0 to half the bits, where other orbits stay far off.
+      if (period % q == 0
+          && (mpfr_zero_p (z_re) || mpfr_get_exp (z_re) < -precision / 2)
+          && (mpfr_zero_p (z_im) || mpfr_get_exp (z_im) < -precision / 2))
+        {
+          exact = q;
+          break;
+        }
+    }
+
+  mpfr_clears (z_re, z_im, sqr_re, sqr_im, (mpfr_ptr)0);
+
+  return exact;
+}
+
+
+// Size of the minibrot of the given period around nucleus c, relative to the
+// whole set: 1 / |b l^2|, with l the derivative of z_period by z_1 and b the
+// sum of 1 / l_j over its prefixes.  It is not meaningful once the
+// generation changed.
+struct floatexp
+nucleus_size (mpfr_t c_re, mpfr_t c_im, int period, int generation)
+{
+  mpfr_t z_re, z_im, sqr_re, sqr_im;
+  mpfr_inits2 (mpfr_get_prec (c_re), z_re, z_im, sqr_re, sqr_im,
+               (mpfr_ptr)0);
+
+  mpfr_set_d (z_re, 0.0, MPFR_RNDN);
+  mpfr_set_d (z_im, 0.0, MPFR_RNDN);
+
+  struct floatexp_complex l = { 1.0, 0.0, 0 };
+  double b_re = 1.0;
+  double b_im = 0.0;
+
+  for (int q = 1; q < period; ++q)
+    {
+      if (generation != atomic_load (&g_generation))
+        break;
+
+      mpfr_sqr (sqr_re, z_re, MPFR_RNDN);
+      mpfr_sqr (sqr_im, z_im, MPFR_RNDN);
+
+      mpfr_mul (z_im, z_re, z_im, MPFR_RNDN);
+      mpfr_mul_2ui (z_im, z_im, 1, MPFR_RNDN);
+      mpfr_add (z_im, z_im, c_im, MPFR_RNDN);
+
+      mpfr_sub (z_re, sqr_re, sqr_im, MPFR_RNDN);
+      mpfr_add (z_re, z_re, c_re, MPFR_RNDN);
+
+      double z_x = mpfr_get_d (z_re, MPFR_RNDN);
+      double z_y = mpfr_get_d (z_im, MPFR_RNDN);
+
+      double l_re = 2.0 * (z_x * l.re - z_y * l.im);
+      double l_im = 2.0 * (z_x * l.im + z_y * l.re);
+
+      l.re = l_re;
+      l.im = l_im;
+      floatexp_complex_normalize (&l);
+
+      double l_norm = l.re * l.re + l.im * l.im;
+
+      if (l_norm == 0.0)
+        break;
+
+      b_re += ldexp (l.re / l_norm, -l.exp);
+      b_im -= ldexp (l.im / l_norm, -l.exp);
+    }
+
+  mpfr_clears (z_re, z_im, sqr_re, sqr_im, (mpfr_ptr)0);
+
+  double magnitude = (l.re * l.re + l.im * l.im) * hypot (b_re, b_im);
+
+  return floatexp_make (1.0 / magnitude, -2 * l.exp);
+}
+
+
+// Looks for the lowest period minibrot within about radius of re + i im and
+// moves re + i im onto its nucleus, with the precision raised to resolve the
+// minibrot NUCLEUS_BITS below its size, which goes to *size.  Returns the
+// period, or 0 with re and im left alone when there is no such minibrot or
+// Newton's method ended up more than NUCLEUS_DISTANCE_MAX radii away.  The
+// search gives up with -1 as soon as the generation changes, so it does not
+// hold up the pool past the view it was started for.
+int
+nucleus_find (mpfr_t re, mpfr_t im, mpfr_t radius, int max_period,
+              struct floatexp *size, int generation)
+{
+  int period = nucleus_period (re, im, radius, max_period, generation);
+
+  if (generation != atomic_load (&g_generation))
+    return -1;
+
+  if (!period)
+    return 0;
+
+  mpfr_t c_re, c_im;
+  mpfr_inits2 (mpfr_get_prec (re), c_re, c_im, (mpfr_ptr)0);
+
+  mpfr_set (c_re, re, MPFR_RNDN);
+  mpfr_set (c_im, im, MPFR_RNDN);
+
+  // Settled in the precision of the view first, as the size it gives tells
+  // how many bits the nucleus needs.
+  int found = nucleus_refine (c_re, c_im, period, NUCLEUS_STEPS, generation);
+
+  if (found)
+    {
+      period = nucleus_exact_period (c_re, c_im, period, generation);
+      *size = nucleus_size (c_re, c_im, period, generation);
+
+      long precision = NUCLEUS_BITS - size->exp;
+
+      if (precision > mpfr_get_prec (c_re))
+        {
+          mpfr_prec_round (c_re, precision, MPFR_RNDN);
+          mpfr_prec_round (c_im, precision, MPFR_RNDN);
+
+          found = nucleus_refine (c_re, c_im, period, NUCLEUS_STEPS,
+                                  generation);
+        }
+    }
+
+  if (found)
+    {
+      mpfr_t d_re, d_im;
+      mpfr_inits2 (mpfr_get_prec (c_re), d_re, d_im, (mpfr_ptr)0);
+
+      mpfr_sub (d_re, c_re, re, MPFR_RNDN);
+      mpfr_sub (d_im, c_im, im, MPFR_RNDN);
+      mpfr_hypot (d_re, d_re, d_im, MPFR_RNDN);
+      mpfr_div (d_re, d_re, radius, MPFR_RNDN);
+
+      found = mpfr_cmp_d (d_re, NUCLEUS_DISTANCE_MAX) <= 0;
+
+      mpfr_clears (d_re, d_im, (mpfr_ptr)0);
+    }
+
+  if (found)
+    {
+      mpfr_set_prec (re, mpfr_get_prec (c_re));
+      mpfr_set_prec (im, mpfr_get_prec (c_im));
+      mpfr_set (re, c_re, MPFR_RNDN);
+      mpfr_set (im, c_im, MPFR_RNDN);
+    }
+
+  mpfr_clears (c_re, c_im, (mpfr_ptr)0);
+
+  if (generation != atomic_load (&g_generation))
+    return -1;
+
+  return found ? period : 0;
+}
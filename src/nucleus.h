@@ -0,0 +1,24 @@
+#ifndef NUCLEUS_H
+#define NUCLEUS_H
+
+#include <mpfr.h>
+
+#include "floatexp.h"
+
+// Nuclei of minibrots: the points c whose orbit comes back to exactly 0
+// after period iterations.  Orbits from them never escape, which makes them
+// the best references for the view around a minibrot.
+
+// Bits kept below the size of a minibrot when its nucleus is refined, so the
+// views down to the minibrot itself and somewhat past it can use it.
+#define NUCLEUS_BITS 96
+
+int nucleus_period (mpfr_t, mpfr_t, mpfr_t, int, int);
+
+int nucleus_refine (mpfr_t, mpfr_t, int, int, int);
+
+struct floatexp nucleus_size (mpfr_t, mpfr_t, int, int);
+
+int nucleus_find (mpfr_t, mpfr_t, mpfr_t, int, struct floatexp *, int);
+
+#endif // NUCLEUS_H
@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+
+#include "orbit-cache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define ORBIT_CACHE_MAGIC "MBORBIT1"
+
+
+// File layout: this header, the key, the final iterate, zero padding up to
+// a multiple of 8 bytes, then amount real parts and amount imaginary parts.
+struct orbit_cache_header
+{
+  char      magic[8];
+  int32_t   amount;
+  int32_t   computed;
+  uint32_t  key_length;
+  uint32_t  z_length;
+};
+
+
+struct orbit_cache
+{
+  char      *directory;
+  long long  limit;
+};
+
+
+struct orbit_cache_file
+{
+  char       name[32];
+  long long  size;
+  long long  used;
+};
+
+
+static void
+orbit_cache_path (const struct orbit_cache *cache, const char *key,
+                  const char *suffix, char **path)
+{
+  // FNV-1a, the full key is checked on load anyway.
+  uint64_t hash = 0xcbf29ce484222325;
+
+  for (const char *c = key; *c; ++c)
+    hash = (hash ^ (unsigned char)*c) * 0x100000001b3;
+
+  if (asprintf (path, "%s/%016llx%s", cache->directory,
+                (unsigned long long)hash, suffix)
+      < 0)
+    *path = NULL;
+}
+
+
+static size_t
+orbit_cache_data_offset (const struct orbit_cache_header *header)
+{
+  size_t offset = sizeof *header + header->key_length + header->z_length;
+
+  return (offset + 7) & ~(size_t)7;
+}
+
+
+// Opens the cache in directory, or under the user cache directory when it is
+// NULL, creating it as needed.  Returns NULL when it can not be created.
+struct orbit_cache *
+orbit_cache_create (const char *directory, long long limit)
+{
+  const char *cache_home = getenv ("XDG_CACHE_HOME");
+  const char *home = getenv ("HOME");
+
+  char *path = NULL;
+  int length = -1;
+
+  if (directory)
+    length = asprintf (&path, "%s", directory);
+  else if (cache_home && *cache_home)
+    length = asprintf (&path, "%s/mandelbrot-orbits", cache_home);
+  else if (home)
+    length = asprintf (&path, "%s/.cache/mandelbrot-orbits", home);
+
+  if (length <= 0)
+    return NULL;
+
+  // Creates the missing parents too.
+  for (char *c = path + 1; *c; ++c)
+    if (*c == '/')
+      {
+        *c = '\0';
+        mkdir (path, 0755);
+        *c = '/';
+      }
+
+  if (mkdir (path, 0755) != 0 && errno != EEXIST)
+    {
+      free (path);
+      return NULL;
+    }
+
+  struct orbit_cache *cache;
+
+  cache = malloc (sizeof (struct orbit_cache));
+
+  if (!cache)
+    {
+      free (path);
+      return NULL;
+    }
+
+  cache->directory = path;
+  cache->limit = limit;
+
+  return cache;
+}
+
+
+void
+orbit_cache_destroy (struct orbit_cache *cache)
+{
+  if (!cache)
+    return;
+
+  free (cache->directory);
+  free (cache);
+}
+
+
+// Reads size bytes at offset, through short reads.  Returns 1 once all of
+// them are in.
+static int
+orbit_cache_read (int fd, void *data, size_t size, off_t offset)
+{
+  char *at = data;
+
+  while (size > 0)
+    {
+      ssize_t length = pread (fd, at, size, offset);
+
+      if (length < 0 && errno == EINTR)
+        continue;
+
+      if (length <= 0)
+        return 0;
+
+      at += length;
+      size -= length;
+      offset += length;
+    }
+
+  return 1;
+}
+
+
+// Reads entries first..amount-1 of the orbit stored under key straight into
+// orbit_re and orbit_im; the orbit must have exactly amount entries.
+// *computed is the amount of entries before the reference escaped and *z a
+// malloc'd copy of the stored final iterate.  Returns 1 on a hit.
+int
+orbit_cache_load (struct orbit_cache *cache, const char *key,
+                  double *orbit_re, double *orbit_im, int first, int amount,
+                  int *computed, char **z)
+{
+  char *path;
+  orbit_cache_path (cache, key, ".orbit", &path);
+
+  if (!path)
+    return 0;
+
+  int fd = open (path, O_RDONLY);
+
+  free (path);
+
+  if (fd < 0)
+    return 0;
+
+  struct stat st;
+  struct orbit_cache_header header;
+  char *strings = NULL;
+  int hit = 0;
+
+  if (fstat (fd, &st) != 0
+      || !orbit_cache_read (fd, &header, sizeof header, 0))
+    goto clean;
+
+  if (memcmp (header.magic, ORBIT_CACHE_MAGIC, sizeof header.magic) != 0
+      || header.amount != amount || header.key_length != strlen (key)
+      || (size_t)st.st_size
+             != orbit_cache_data_offset (&header)
+                    + 2 * (size_t)amount * sizeof (double))
+    goto clean;
+
+  // The key and the final iterate follow the header.
+  strings = malloc (header.key_length + header.z_length);
+
+  if (!strings
+      || !orbit_cache_read (fd, strings,
+                            header.key_length + header.z_length,
+                            sizeof header)
+      || memcmp (strings, key, header.key_length) != 0)
+    goto clean;
+
+  off_t data = orbit_cache_data_offset (&header);
+  size_t size = (amount - first) * sizeof (double);
+
+  if (!orbit_cache_read (fd, orbit_re + first, size,
+                         data + first * sizeof (double))
+      || !orbit_cache_read (fd, orbit_im + first, size,
+                            data + (amount + first) * sizeof (double)))
+    goto clean;
+
+  *computed = header.computed;
+  *z = strndup (strings + header.key_length, header.z_length);
+
+  // The modification time orders the entries for eviction.
+  futimens (fd, NULL);
+
+  hit = 1;
+
+clean:
+  free (strings);
+  close (fd);
+
+  return hit;
+}
+
+
+static int
+orbit_cache_compare (const void *a, const void *b)
+{
+  const struct orbit_cache_file *x = a;
+  const struct orbit_cache_file *y = b;
+
+  return (x->used > y->used) - (x->used < y->used);
+}
+
+
+// Removes the least recently used orbits until the directory fits the limit.
+static void
+orbit_cache_evict (struct orbit_cache *cache)
+{
+  DIR *dir = opendir (cache->directory);
+
+  if (!dir)
+    return;
+
+  struct orbit_cache_file *files = NULL;
+  int files_amount = 0;
+  int files_capacity = 0;
+  long long total = 0;
+
+  struct dirent *entry;
+
+  while ((entry = readdir (dir)))
+    {
+      size_t length = strlen (entry->d_name);
+
+      if (length < 6 || length >= sizeof files->name
+          || strcmp (entry->d_name + length - 6, ".orbit") != 0)
+        continue;
+
+      struct stat st;
+
+      if (fstatat (dirfd (dir), entry->d_name, &st, 0) != 0)
+        continue;
+
+      if (files_amount == files_capacity)
+        {
+          int capacity = files_capacity ? 2 * files_capacity : 64;
+          struct orbit_cache_file *grown;
+
+          grown = realloc (files, capacity * sizeof (struct orbit_cache_file));
+
+          // Evicts among the files seen so far.
+          if (!grown)
+            break;
+
+          files = grown;
+          files_capacity = capacity;
+        }
+
+      struct orbit_cache_file *file = &files[files_amount++];
+
+      strcpy (file->name, entry->d_name);
+      file->size = st.st_size;
+      file->used = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+      total += st.st_size;
+    }
+
+  qsort (files, files_amount, sizeof (struct orbit_cache_file),
+         orbit_cache_compare);
+
+  for (int i = 0; i < files_amount && total > cache->limit; ++i)
+    if (unlinkat (dirfd (dir), files[i].name, 0) == 0)
+      total -= files[i].size;
+
+  free (files);
+  closedir (dir);
+}
+
+
+// Stores amount orbit entries under key, replacing what was there.  Returns
+// 1 when the orbit was written.
+int
+orbit_cache_store (struct orbit_cache *cache, const char *key,
+                   const double *orbit_re, const double *orbit_im, int amount,
+                   int computed, const char *z)
+{
+  char *path, *temp_path;
+  orbit_cache_path (cache, key, ".orbit", &path);
+  orbit_cache_path (cache, key, ".tmp.XXXXXX", &temp_path);
+
+  int stored = 0;
+
+  if (!path || !temp_path)
+    goto clean;
+
+  struct orbit_cache_header header;
+
+  memcpy (header.magic, ORBIT_CACHE_MAGIC, sizeof header.magic);
+  header.amount = amount;
+  header.computed = computed;
+  header.key_length = strlen (key);
+  header.z_length = strlen (z);
+
+  static const char padding[8];
+  size_t padding_length = orbit_cache_data_offset (&header) - sizeof header
+                          - header.key_length - header.z_length;
+
+  // Unique, as other processes may store the same key at the same time.
+  int fd = mkstemp (temp_path);
+
+  if (fd < 0)
+    goto clean;
+
+  FILE *file = fdopen (fd, "wb");
+
+  if (!file)
+    {
+      close (fd);
+      unlink (temp_path);
+      goto clean;
+    }
+
+  int written = fwrite (&header, sizeof header, 1, file) == 1
+                && fwrite (key, 1, header.key_length, file)
+                       == header.key_length
+                && fwrite (z, 1, header.z_length, file) == header.z_length
+                && fwrite (padding, 1, padding_length, file) == padding_length
+                && fwrite (orbit_re, sizeof (double), amount, file)
+                       == (size_t)amount
+                && fwrite (orbit_im, sizeof (double), amount, file)
+                       == (size_t)amount;
+
+  // Written aside and renamed, so a reader never sees half an orbit.
+  if (fclose (file) != 0 || !written || rename (temp_path, path) != 0)
+    {
+      unlink (temp_path);
+      goto clean;
+    }
+
+  stored = 1;
+
+  orbit_cache_evict (cache);
+
+clean:
+  free (path);
+  free (temp_path);
+
+  return stored;
+}
@@ -0,0 +1,21 @@
+#ifndef ORBIT_CACHE_H
+#define ORBIT_CACHE_H
+
+// Reference orbits kept on disk, one file per key, evicted least recently
+// used first once the directory grows past its size limit.
+struct orbit_cache;
+
+// Default size limit of the directory in bytes.
+#define ORBIT_CACHE_LIMIT (1LL << 30)
+
+struct orbit_cache *orbit_cache_create (const char *, long long);
+
+void orbit_cache_destroy (struct orbit_cache *);
+
+int orbit_cache_load (struct orbit_cache *, const char *, double *, double *,
+                      int, int, int *, char **);
+
+int orbit_cache_store (struct orbit_cache *, const char *, const double *,
+                       const double *, int, int, const char *);
+
+#endif // ORBIT_CACHE_H
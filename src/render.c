@@ -0,0 +1,3995 @@
+#include "render.h"
+#include "orbit-cache.h"
+#include "thread-pool.h"
+#include <float.h>
+#include <immintrin.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+atomic_int g_generation;
+atomic_bool g_orbit_ready;
+
+double *g_orbit_re;
+double *g_orbit_im;
+atomic_int g_orbit_amount;
+atomic_int g_orbit_valid;
+atomic_bool g_bla_ready;
+
+int g_width;
+int g_height;
+
+_Atomic uint32_t *pixels;
+pthread_mutex_t pixels_mutex;
+
+_Atomic int32_t *pixels_iter;
+_Atomic float *pixels_smooth;
+
+_Atomic int64_t *pixels_done;
+double *pixels_zn2;
+struct render_pixel_state *pixels_state;
+
+atomic_llong g_stat_iterations;
+atomic_llong g_stat_rebases;
+
+struct bla_table g_bla;
+
+struct orbit_cache *g_orbit_cache;
+
+// The reference orbit as last computed: its center, the iterate following
+// its last stored entry and how many entries were stored before it escaped,
+// so render_enqueue_extend can continue it instead of starting over.
+// g_orbit_escaped is the last of them when it escaped, or -1, and is set
+// before the complete orbit is published.
+static mpfr_t g_orbit_center_re;
+static mpfr_t g_orbit_center_im;
+static mpfr_t g_orbit_z_re;
+static mpfr_t g_orbit_z_im;
+static int g_orbit_computed;
+static atomic_int g_orbit_escaped;
+static struct floatexp g_orbit_dc_max;
+
+// Views with pixels at least 2^(RENDER_DIRECT_EXP - 1) apart, about 5e-7,
+// take the orbit of 0 as their reference, with g_orbit_direct set.  It
+// stays at 0, so perturbation around it is plain iteration of z^2 + c in
+// doubles, and no MPFR orbit is computed for them.  Doubles would resolve
+// the pixels down to about 1e-13, but their rounding, grown over a few
+// thousand iterations, shows well before that.  At 8192 iterations, of the
+// pixels near Seahorse Valley, 0.4% get another count than perturbation
+// at 5e-7, 1.8% at 1e-8 and 3.1% at 1e-10, and perturbation is the one
+// that matches MPFR.  Near the spiral at -0.7757 + 0.1365i it is 0.02% at
+// 5e-7 and 4.3% at 1e-13.
+#define RENDER_DIRECT_EXP -20
+
+static int g_orbit_direct;
+
+// Where orbits are computed from instead of the view center once set with
+// render_set_reference, like the nucleus of a minibrot.
+static mpfr_t g_reference_re;
+static mpfr_t g_reference_im;
+static int g_reference_set;
+
+// References placed in the glitches of the pixels, see
+// RENDER_GLITCH_TOLERANCE, for the orbit of g_orbit_center_re and
+// g_orbit_center_im.  They are shared by the work on it until the orbit is
+// enqueued or extended again.  An entry is taken while its orbit is
+// computed and ready once it is, which g_secondary_cond signals.
+#define RENDER_SECONDARY_MAX 32
+
+struct render_secondary
+{
+  // Where it lies from the reference, and the iteration its pixel
+  // glitched at.
+  struct floatexp_complex dc;
+  int glitch_iter;
+  int max_iter;
+  double *orbit_re;
+  double *orbit_im;
+  int orbit_capacity;
+  int orbit_escaped;
+  int ready;
+};
+
+static struct render_secondary g_secondaries[RENDER_SECONDARY_MAX];
+static int g_secondaries_amount;
+static pthread_mutex_t g_secondary_mutex;
+static pthread_cond_t g_secondary_cond;
+
+// Signalled whenever g_orbit_valid advances or the orbit work stops.
+static pthread_mutex_t g_orbit_mutex;
+static pthread_cond_t g_orbit_cond;
+
+// Entries published at a time while the orbit is computed.
+#define RENDER_ORBIT_CHUNK 1024
+
+// Orbits computed faster than this are not worth a file in the cache.
+#define RENDER_ORBIT_CACHE_MIN_MS 50.0
+
+// Set for every RENDER_DIRTY_CELL square of pixels changed since
+// render_take_dirty last looked at it.
+#define RENDER_DIRTY_CELL 32
+
+static atomic_uchar *g_dirty;
+static int g_dirty_columns;
+static int g_dirty_rows;
+
+// Iterations spent per RENDER_COST_CELL square of pixels since the last
+// render_reset or render_resume, and as of then in g_cost_last, which
+// render_enqueue_pass schedules its tiles by.
+#define RENDER_COST_CELL 8
+
+static atomic_llong *g_cost;
+static long long *g_cost_last;
+static int g_cost_columns;
+static int g_cost_rows;
+
+// Set once a pixel of the frame turned out inside, and as of the next
+// render_reset or render_resume in g_interior_last, see render_flush_run.
+static atomic_int g_interior;
+static int g_interior_last;
+
+// Where the viewer looks, tiles of equal cost are enqueued nearest first.
+static int g_focus_x;
+static int g_focus_y;
+
+// How pixels map to points, see render_set_map.
+static int g_map;
+
+// Extra samples of the pixels render_supersample went over, at most
+// RENDER_SAMPLES_MAX - 1 per pixel, with g_samples_amount of them in use
+// for each.  g_samples is only allocated once supersampling is asked for.
+#define RENDER_SAMPLES_MAX 8
+
+struct render_sample
+{
+  int32_t iter;
+  float smooth;
+};
+
+static struct render_sample *g_samples;
+static atomic_uchar *g_samples_amount;
+
+// Generation of the passes that filled pixels_done since render_reset.
+static int g_frame_generation;
+
+// Work items of the current generation.  They are handed out by the
+// enqueuing thread from a list of blocks, which are all reused from the
+// start once the generation moved on; the work of older generations must be
+// finished or dropped by then.
+struct render_arena_block
+{
+  struct render_arena_block *next;
+  size_t used;
+  size_t capacity;
+  _Alignas (16) unsigned char data[];
+};
+
+#define RENDER_ARENA_BLOCK_SIZE (256 * 1024)
+
+static struct render_arena_block *g_arena_first;
+static struct render_arena_block *g_arena_current;
+static int g_arena_generation;
+
+// Iterations pixels run before they start looking for cycles, where the
+// frame or the last one had interior pixels.  Elsewhere the search mostly
+// costs, about a third more per iteration, so it waits for the pixels still
+// going after 1 / RENDER_PERIOD_FRACTION of max_iter.
+#define RENDER_PERIOD_START 1024
+#define RENDER_PERIOD_FRACTION 4
+
+// A cycle is found where z comes back to within 2^RENDER_PERIOD_BITS of its
+// magnitude at the save, less as the derivative since then nears 1, so it
+// attracts all points that close.  Saving at the lowest z of the window,
+// where the cycle passes by zero, that is the distance that matters at any
+// depth.  It is taken from the deltas and the reference entries, whose
+// rounding there is within that of z.
+#define RENDER_PERIOD_BITS -12
+
+// Pauldelbrot's glitch test: where z comes this much closer to zero than
+// the reference, squared, the rounding of the delta, relative to the
+// reference, is no longer small against z, and rebasing would carry it on.
+// Such pixels stop there and are taken again against a secondary reference
+// near them, see render_batch_deglitch.  It implies |dz| > |z|, so it is
+// only checked where pixels rebase, and |dz| stands in for the reference,
+// within a thousandth of it there.  What it costs is the secondary orbits,
+// a full MPFR orbit each, some 7 ms at 16384 iterations and 1e-50, so one
+// serves as many glitches as it can, see render_secondary_take.
+#define RENDER_GLITCH_TOLERANCE 1e-6
+
+// Deltas below 2^FLOATEXP_SWITCH_EXP are iterated as floatexp.
+#define FLOATEXP_SWITCH_EXP -960
+#define FLOATEXP_REBASE_LIMIT 0x1p-880
+
+static void render_init_kernels (void);
+
+void
+render_init (int width, int height)
+{
+  g_width = width;
+  g_height = height;
+
+  pixels = calloc ((size_t)width * height, sizeof (uint32_t));
+  pixels_iter = calloc ((size_t)width * height, sizeof (int32_t));
+  pixels_smooth = calloc ((size_t)width * height, sizeof (float));
+  g_samples_amount = calloc ((size_t)width * height, sizeof (atomic_uchar));
+  pixels_done = calloc ((size_t)width * height, sizeof (int64_t));
+  pixels_zn2 = calloc ((size_t)width * height, sizeof (double));
+  pixels_state
+      = calloc ((size_t)width * height, sizeof (struct render_pixel_state));
+
+  g_dirty_columns = (width + RENDER_DIRTY_CELL - 1) / RENDER_DIRTY_CELL;
+  g_dirty_rows = (height + RENDER_DIRTY_CELL - 1) / RENDER_DIRTY_CELL;
+  g_dirty = calloc ((size_t)g_dirty_columns * g_dirty_rows,
+                    sizeof (atomic_uchar));
+
+  g_cost_columns = (width + RENDER_COST_CELL - 1) / RENDER_COST_CELL;
+  g_cost_rows = (height + RENDER_COST_CELL - 1) / RENDER_COST_CELL;
+  g_cost = calloc ((size_t)g_cost_columns * g_cost_rows,
+                   sizeof (atomic_llong));
+  g_cost_last = calloc ((size_t)g_cost_columns * g_cost_rows,
+                        sizeof (long long));
+
+  g_focus_x = width / 2;
+  g_focus_y = height / 2;
+
+  pthread_mutex_init (&pixels_mutex, NULL);
+  pthread_mutex_init (&g_orbit_mutex, NULL);
+  pthread_cond_init (&g_orbit_cond, NULL);
+  pthread_mutex_init (&g_secondary_mutex, NULL);
+  pthread_cond_init (&g_secondary_cond, NULL);
+
+  mpfr_inits2 (PRECISION_MIN, g_orbit_center_re, g_orbit_center_im,
+               g_orbit_z_re, g_orbit_z_im, g_reference_re, g_reference_im,
+               (mpfr_ptr)0);
+
+  render_init_kernels ();
+}
+
+void
+render_quit (void)
+{
+  pthread_mutex_destroy (&pixels_mutex);
+  pthread_mutex_destroy (&g_orbit_mutex);
+  pthread_cond_destroy (&g_orbit_cond);
+  pthread_mutex_destroy (&g_secondary_mutex);
+  pthread_cond_destroy (&g_secondary_cond);
+
+  for (int i = 0; i < RENDER_SECONDARY_MAX; ++i)
+    {
+      free (g_secondaries[i].orbit_re);
+      free (g_secondaries[i].orbit_im);
+    }
+
+  free (pixels);
+  free (pixels_iter);
+  free (pixels_smooth);
+  free (g_samples);
+  free (g_samples_amount);
+  free (pixels_done);
+  free (pixels_zn2);
+  free (pixels_state);
+  free (g_dirty);
+  free (g_cost);
+  free (g_cost_last);
+
+  bla_table_free (&g_bla);
+
+  mpfr_clears (g_orbit_center_re, g_orbit_center_im, g_orbit_z_re,
+               g_orbit_z_im, g_reference_re, g_reference_im, (mpfr_ptr)0);
+
+  while (g_arena_first)
+    {
+      struct render_arena_block *next = g_arena_first->next;
+
+      free (g_arena_first);
+      g_arena_first = next;
+    }
+
+  g_arena_current = NULL;
+}
+
+// Keeps what the frame so far cost for the next passes to schedule by, and
+// whether it had interior pixels.  Cells without any work recorded, as when
+// the frame was cut short, keep their older cost, and a frame without any
+// keeps the older interior.
+static void
+render_cost_snapshot (void)
+{
+  long long total = 0;
+
+  for (int i = 0; i < g_cost_columns * g_cost_rows; ++i)
+    {
+      long long cost = atomic_exchange_explicit (&g_cost[i], 0,
+                                                 memory_order_relaxed);
+
+      if (cost > 0)
+        g_cost_last[i] = cost;
+
+      total += cost;
+    }
+
+  if (total > 0)
+    g_interior_last = atomic_exchange (&g_interior, 0);
+}
+
+void
+render_reset (void)
+{
+  render_cost_snapshot ();
+
+  for (size_t i = 0; i < (size_t)g_width * g_height; ++i)
+    {
+      atomic_store_explicit (&pixels[i], 0, memory_order_relaxed);
+      atomic_store_explicit (&pixels_iter[i], -2, memory_order_relaxed);
+      atomic_store_explicit (&g_samples_amount[i], 0, memory_order_relaxed);
+    }
+
+  for (size_t i = 0; i < (size_t)g_width * g_height; ++i)
+    atomic_store_explicit (&pixels_done[i], -1, memory_order_relaxed);
+
+  for (int i = 0; i < g_dirty_columns * g_dirty_rows; ++i)
+    atomic_store (&g_dirty[i], 1);
+
+  g_frame_generation = atomic_load (&g_generation);
+}
+
+// Keeps the pixels of the last frame for passes of the current generation,
+// after max_iter was raised: pixels that stopped at the old max_iter carry
+// on from their pixels_state, the others are final.
+void
+render_resume (void)
+{
+  int generation = atomic_load (&g_generation);
+
+  render_cost_snapshot ();
+
+  for (size_t i = 0; i < (size_t)g_width * g_height; ++i)
+    {
+      int64_t done = atomic_load_explicit (&pixels_done[i],
+                                           memory_order_relaxed);
+
+      if (done != -1 && (int)(done >> 32) == g_frame_generation)
+        atomic_store_explicit (&pixels_done[i],
+                               (int64_t)generation << 32 | (uint32_t)done,
+                               memory_order_relaxed);
+
+      // Samples that stopped at the old max_iter are taken again.
+      int amount = atomic_load_explicit (&g_samples_amount[i],
+                                         memory_order_relaxed);
+
+      for (int s = 0; s < amount; ++s)
+        if (g_samples[i * (RENDER_SAMPLES_MAX - 1) + s].iter == -1)
+          {
+            atomic_store_explicit (&g_samples_amount[i], 0,
+                                   memory_order_relaxed);
+            break;
+          }
+    }
+
+  g_frame_generation = generation;
+}
+
+// Final iteration count of the pixel at index i if it was already computed
+// for this generation, -1 otherwise.
+static inline int
+render_done_load (int generation, size_t i, double *zn2)
+{
+  int64_t done = atomic_load_explicit (&pixels_done[i], memory_order_acquire);
+
+  if (done == -1 || (int)(done >> 32) != generation)
+    return -1;
+
+  *zn2 = pixels_zn2[i];
+
+  return (int)(uint32_t)done;
+}
+
+// Whether the pixel at index i already has its own value for this
+// generation, which the blocks of coarser passes must not paint over.
+static inline int
+render_done_final (int generation, size_t i)
+{
+  int64_t done = atomic_load_explicit (&pixels_done[i], memory_order_relaxed);
+
+  return done != -1 && (int)(done >> 32) == generation;
+}
+
+static inline void
+render_done_store (int generation, size_t i, int iter, double zn2,
+                   const struct render_pixel_state *state)
+{
+  pixels_zn2[i] = zn2;
+
+  if (state)
+    pixels_state[i] = *state;
+  else
+    pixels_state[i].iter = -1;
+
+  atomic_store_explicit (&pixels_done[i],
+                         (int64_t)generation << 32 | (uint32_t)iter,
+                         memory_order_release);
+}
+
+static inline uint32_t
+interpolate_color (uint32_t c1, uint32_t c2, double frac)
+{
+  uint8_t r1 = (c1 >> 16) & 0xFF;
+  uint8_t g1 = (c1 >> 8) & 0xFF;
+  uint8_t b1 = c1 & 0xFF;
+
+  uint8_t r2 = (c2 >> 16) & 0xFF;
+  uint8_t g2 = (c2 >> 8) & 0xFF;
+  uint8_t b2 = c2 & 0xFF;
+
+  uint8_t r = (1.0f - frac) * r1 + frac * r2;
+  uint8_t g = (1.0f - frac) * g1 + frac * g2;
+  uint8_t b = (1.0f - frac) * b1 + frac * b2;
+
+  return 0xFF000000 | (r << 16) | (g << 8) | b;
+}
+
+static void
+render_orbit_publish (int valid)
+{
+  atomic_store_explicit (&g_orbit_valid, valid, memory_order_release);
+
+  pthread_mutex_lock (&g_orbit_mutex);
+  pthread_cond_broadcast (&g_orbit_cond);
+  pthread_mutex_unlock (&g_orbit_mutex);
+}
+
+// Iterates z from orbit index iter up to max_iter, storing every iterate
+// before stepping.  Returns the amount of entries stored, which is below
+// max_iter when z escaped or the generation changed.  With publish set, the
+// stored prefix goes out to g_orbit_valid every RENDER_ORBIT_CHUNK entries.
+// Secondary references are computed alongside the orbit and each other, so
+// the squares are its own.
+static int
+render_orbit_iterate (mpfr_t center_re, mpfr_t center_im, mpfr_t z_re,
+                      mpfr_t z_im, double *orbit_re, double *orbit_im,
+                      int iter, int max_iter, int generation, int publish)
+{
+  // The escape test is done on the doubles that are stored anyway; the
+  // reference runs to |z| > ESCAPE_RADIUS^2.
+  const double escape_norm = ESCAPE_RADIUS * ESCAPE_RADIUS * ESCAPE_RADIUS
+                             * ESCAPE_RADIUS;
+
+  mpfr_t sqr_re, sqr_im;
+  mpfr_inits2 (mpfr_get_prec (z_re), sqr_re, sqr_im, (mpfr_ptr)0);
+
+  while (iter < max_iter)
+    {
+      if (generation != atomic_load (&g_generation))
+        break;
+
+      double z_x = mpfr_get_d (z_re, MPFR_RNDN);
+      double z_y = mpfr_get_d (z_im, MPFR_RNDN);
+
+      if (z_x * z_x + z_y * z_y > escape_norm)
+        break;
+
+      orbit_re[iter] = z_x;
+      orbit_im[iter] = z_y;
+
+      iter++;
+
+      if (publish && iter % RENDER_ORBIT_CHUNK == 0)
+        render_orbit_publish (iter);
+
+      // z = (re^2 - im^2 + c_re) + i (2 re im + c_im): two squarings and one
+      // multiplication.
+      mpfr_sqr (sqr_re, z_re, MPFR_RNDN);
+      mpfr_sqr (sqr_im, z_im, MPFR_RNDN);
+
+      mpfr_mul (z_im, z_re, z_im, MPFR_RNDN);
+      mpfr_mul_2ui (z_im, z_im, 1, MPFR_RNDN);
+      mpfr_add (z_im, z_im, center_im, MPFR_RNDN);
+
+      mpfr_sub (z_re, sqr_re, sqr_im, MPFR_RNDN);
+      mpfr_add (z_re, z_re, center_re, MPFR_RNDN);
+    }
+
+  mpfr_clears (sqr_re, sqr_im, (mpfr_ptr)0);
+
+  return iter;
+}
+
+void
+render_compute_orbit (mpfr_t center_re, mpfr_t center_im, double *orbit_re,
+                      double *orbit_im, int max_iter, int generation)
+{
+  mpfr_t z_re, z_im;
+  mpfr_inits2 (mpfr_get_prec (center_re), z_re, z_im, (mpfr_ptr)0);
+
+  mpfr_set_d (z_re, 0.0, MPFR_RNDN);
+  mpfr_set_d (z_im, 0.0, MPFR_RNDN);
+
+  render_orbit_iterate (center_re, center_im, z_re, z_im, orbit_re, orbit_im,
+                        0, max_iter, generation, 0);
+
+  mpfr_clears (z_re, z_im, (mpfr_ptr)0);
+}
+
+// Distance from the center of row y of the exponential map, in pixel
+// spacings of row 0.  Rows are as far apart as the columns around them.
+static double
+render_map_radius (double y)
+{
+  return g_width / (2 * M_PI) * exp (2 * M_PI * y / g_width);
+}
+
+// Distance of the pixels of the view farthest from its center.
+static double
+render_view_radius (void)
+{
+  if (g_map == RENDER_MAP_EXP)
+    return render_map_radius (g_height);
+
+  return hypot (g_width / 2.0, g_height / 2.0);
+}
+
+// Whether the point offset pixels away from the view center lies in the
+// view.
+static int
+render_view_contains (double offset_re, double offset_im)
+{
+  if (g_map == RENDER_MAP_EXP)
+    return hypot (offset_re, offset_im) <= render_map_radius (g_height);
+
+  return fabs (offset_re) <= g_width / 2.0
+         && fabs (offset_im) <= g_height / 2.0;
+}
+
+// Largest |delta_c| of the view, whose center is work->offset pixels away
+// from the reference.
+static struct floatexp
+render_orbit_dc_max (const struct orbit_work *work)
+{
+  double radius = render_view_radius ()
+                  + hypot (work->offset_re, work->offset_im);
+
+  return floatexp_mul_d (work->scale, radius);
+}
+
+// Stores the orbit from index computed on, which stays zero past an escaped
+// reference as in a fresh orbit, builds the BLA table over the entries
+// before it and publishes it all.
+static void
+render_orbit_finish (const struct orbit_work *work, int computed,
+                     struct floatexp dc_max)
+{
+  int amount = work->max_iter + 1;
+
+  for (int i = computed; i < amount; ++i)
+    g_orbit_re[i] = g_orbit_im[i] = 0.0;
+
+  atomic_store (&g_orbit_escaped, computed < amount ? computed - 1 : -1);
+
+  render_orbit_publish (amount);
+
+  // Around the orbit of 0 no step is linear, it gets an empty table.
+  bla_table_build (&g_bla, g_orbit_re, g_orbit_im,
+                   g_orbit_direct ? 0 : computed, dc_max);
+
+  pthread_mutex_lock (&pixels_mutex);
+  g_orbit_computed = computed;
+  g_orbit_dc_max = dc_max;
+
+  atomic_store (&g_bla_ready, 1);
+  atomic_store (&g_orbit_ready, 1);
+  pthread_mutex_unlock (&pixels_mutex);
+}
+
+static double
+render_time_ms (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// x as a base 16 string that mpfr_set_str reads back exactly.
+static char *
+render_orbit_number (mpfr_t x)
+{
+  mpfr_exp_t exp;
+  char *digits = mpfr_get_str (NULL, &exp, 16, 0, x, MPFR_RNDN);
+
+  int negative = digits[0] == '-';
+  size_t length = strlen (digits) + 32;
+  char *number = malloc (length);
+
+  snprintf (number, length, "%s0.%s@%ld", negative ? "-" : "",
+            digits + negative, (long)exp);
+
+  mpfr_free_str (digits);
+  return number;
+}
+
+// Joins the numbers a and b with a space, with the integers in front.
+static char *
+render_orbit_string (long precision, int max_iter, mpfr_t a, mpfr_t b)
+{
+  char *number_a = render_orbit_number (a);
+  char *number_b = render_orbit_number (b);
+
+  size_t length = strlen (number_a) + strlen (number_b) + 64;
+  char *string = malloc (length);
+
+  if (precision > 0)
+    snprintf (string, length, "%ld %d %s %s", precision, max_iter, number_a,
+              number_b);
+  else
+    snprintf (string, length, "%s %s", number_a, number_b);
+
+  free (number_a);
+  free (number_b);
+  return string;
+}
+
+// Fetches the orbit entries first..max_iter of the current reference from
+// g_orbit_cache into g_orbit_re and g_orbit_im, and with them the iterate
+// following the last stored entry.  Returns 1 on a hit.
+static int
+render_orbit_load (int first, int max_iter, int *computed)
+{
+  if (!g_orbit_cache)
+    return 0;
+
+  char *key = render_orbit_string (mpfr_get_prec (g_orbit_center_re),
+                                   max_iter, g_orbit_center_re,
+                                   g_orbit_center_im);
+  char *z = NULL;
+
+  int hit = orbit_cache_load (g_orbit_cache, key, g_orbit_re, g_orbit_im,
+                              first, max_iter + 1, computed, &z);
+
+  if (hit)
+    {
+      char *z_im = strchr (z, ' ');
+
+      if (z_im)
+        *z_im++ = '\0';
+
+      hit = z_im && mpfr_set_str (g_orbit_z_re, z, 16, MPFR_RNDN) == 0
+            && mpfr_set_str (g_orbit_z_im, z_im, 16, MPFR_RNDN) == 0;
+    }
+
+  free (key);
+  free (z);
+  return hit;
+}
+
+static void
+render_orbit_store (int max_iter, int computed)
+{
+  if (!g_orbit_cache)
+    return;
+
+  char *key = render_orbit_string (mpfr_get_prec (g_orbit_center_re),
+                                   max_iter, g_orbit_center_re,
+                                   g_orbit_center_im);
+  char *z = render_orbit_string (0, 0, g_orbit_z_re, g_orbit_z_im);
+
+  orbit_cache_store (g_orbit_cache, key, g_orbit_re, g_orbit_im,
+                     max_iter + 1, computed, z);
+
+  free (key);
+  free (z);
+}
+
+// Computes the orbit of g_orbit_center_re + i g_orbit_center_im straight
+// into g_orbit_re and g_orbit_im, publishing it as it goes, unless
+// g_orbit_cache already has it.
+void
+render_compute_orbit_thread (void *argument)
+{
+  struct orbit_work *work = argument;
+
+  mpfr_set_prec (g_orbit_z_re, mpfr_get_prec (g_orbit_center_re));
+  mpfr_set_prec (g_orbit_z_im, mpfr_get_prec (g_orbit_center_re));
+
+  int computed;
+  int store = 0;
+
+  if (!render_orbit_load (0, work->max_iter, &computed))
+    {
+      double start = render_time_ms ();
+
+      mpfr_set_d (g_orbit_z_re, 0.0, MPFR_RNDN);
+      mpfr_set_d (g_orbit_z_im, 0.0, MPFR_RNDN);
+
+      computed = render_orbit_iterate (
+          g_orbit_center_re, g_orbit_center_im, g_orbit_z_re, g_orbit_z_im,
+          g_orbit_re, g_orbit_im, 0, work->max_iter + 1, work->generation, 1);
+
+      store = render_time_ms () - start >= RENDER_ORBIT_CACHE_MIN_MS;
+    }
+
+  if (work->generation == atomic_load (&g_generation))
+    {
+      render_orbit_finish (work, computed, render_orbit_dc_max (work));
+
+      // The pixels go on meanwhile, the next frame waits for this task
+      // before it touches the orbit again.
+      if (store)
+        render_orbit_store (work->max_iter, computed);
+    }
+
+  // Wakes pixel work waiting on an orbit that will not come.
+  render_orbit_publish (atomic_load (&g_orbit_valid));
+}
+
+// Keeps the current orbit for a view around it; only the BLA table depends on
+// the view.
+void
+render_reuse_orbit_thread (void *argument)
+{
+  struct orbit_work *work = argument;
+
+  render_orbit_finish (work, g_orbit_computed, render_orbit_dc_max (work));
+}
+
+// Continues the current orbit up to work->max_iter, directly in g_orbit_re
+// and g_orbit_im which must already have room for it.
+void
+render_extend_orbit_thread (void *argument)
+{
+  struct orbit_work *work = argument;
+
+  int valid = atomic_load (&g_orbit_valid);
+  int computed = g_orbit_computed;
+
+  // The iterate is only advanced once the whole extension went through.
+  mpfr_t z_re, z_im;
+  mpfr_inits2 (mpfr_get_prec (g_orbit_z_re), z_re, z_im, (mpfr_ptr)0);
+
+  mpfr_set (z_re, g_orbit_z_re, MPFR_RNDN);
+  mpfr_set (z_im, g_orbit_z_im, MPFR_RNDN);
+
+  int cached = computed == valid
+               && render_orbit_load (valid, work->max_iter, &computed);
+  double start = render_time_ms ();
+
+  if (computed == valid && !cached)
+    computed = render_orbit_iterate (g_orbit_center_re, g_orbit_center_im,
+                                     z_re, z_im, g_orbit_re, g_orbit_im,
+                                     valid, work->max_iter + 1,
+                                     work->generation, 1);
+
+  int store = !cached
+              && render_time_ms () - start >= RENDER_ORBIT_CACHE_MIN_MS;
+
+  if (work->generation == atomic_load (&g_generation))
+    {
+      if (!cached)
+        {
+          mpfr_set (g_orbit_z_re, z_re, MPFR_RNDN);
+          mpfr_set (g_orbit_z_im, z_im, MPFR_RNDN);
+        }
+
+      render_orbit_finish (work, computed, g_orbit_dc_max);
+
+      if (store)
+        render_orbit_store (work->max_iter, computed);
+    }
+
+  render_orbit_publish (atomic_load (&g_orbit_valid));
+
+  mpfr_clears (z_re, z_im, (mpfr_ptr)0);
+}
+
+// Fills in the orbit of 0 up to work->max_iter, see RENDER_DIRECT_EXP.  It
+// never escapes.  The lanes do not even read it, only the scalar kernel
+// does.
+void
+render_direct_orbit_thread (void *argument)
+{
+  struct orbit_work *work = argument;
+
+  int amount = work->max_iter + 1;
+
+  // Extending it only takes the new entries.
+  for (int i = atomic_load (&g_orbit_valid); i < amount; ++i)
+    g_orbit_re[i] = g_orbit_im[i] = 0.0;
+
+  if (work->generation == atomic_load (&g_generation))
+    render_orbit_finish (work, amount, render_orbit_dc_max (work));
+
+  render_orbit_publish (atomic_load (&g_orbit_valid));
+}
+
+// The cycle search of a pixel, see RENDER_PERIOD_BITS: z at the last save
+// as the reference entry and the delta, its squared magnitude, and the
+// derivative of z since then.
+struct render_period
+{
+  double ref_re;
+  double ref_im;
+  double dz_re;
+  double dz_im;
+  double norm;
+  double der_re;
+  double der_im;
+  int step;
+  int window;
+};
+
+struct render_state
+{
+  double dz_re;
+  double dz_im;
+  long dz_exp;
+  int iter;
+  int iter_orbit;
+  double zn2;
+  int interior;
+  // |z|^2 / |dz|^2 where the pixel glitched, or -1.
+  double glitch;
+  struct render_period period;
+};
+
+static void
+render_period_init (struct render_period *period)
+{
+  period->ref_re = period->ref_im = NAN;
+  period->dz_re = period->dz_im = NAN;
+  period->norm = INFINITY;
+  period->der_re = 1.0;
+  period->der_im = 0.0;
+  period->step = 0;
+  period->window = 1;
+}
+
+// Takes z, the reference entry plus dz, and returns 1 when it is back at
+// the saved one on an attracting cycle.  The save starts over after 1, 2,
+// 4, ... steps Brent's way, and moves on to every lower z in between.
+static inline int
+render_period_step (const struct render_work *work,
+                    struct render_period *period, double ref_re,
+                    double ref_im, double dz_re, double dz_im)
+{
+  double diff_re = (ref_re - period->ref_re) + (dz_re - period->dz_re);
+  double diff_im = (ref_im - period->ref_im) + (dz_im - period->dz_im);
+  double contraction = 1.0 - (period->der_re * period->der_re
+                              + period->der_im * period->der_im);
+
+  if (contraction > 0.0
+      && 4.0 * (diff_re * diff_re + diff_im * diff_im)
+             < work->period_tolerance * period->norm * contraction
+                   * contraction)
+    return 1;
+
+  if (++period->step == period->window)
+    {
+      period->norm = INFINITY;
+      period->step = 0;
+
+      if (period->window < 1 << 30)
+        period->window *= 2;
+    }
+
+  double z_re = ref_re + dz_re;
+  double z_im = ref_im + dz_im;
+  double norm = z_re * z_re + z_im * z_im;
+
+  if (norm < period->norm)
+    {
+      period->ref_re = ref_re;
+      period->ref_im = ref_im;
+      period->dz_re = dz_re;
+      period->dz_im = dz_im;
+      period->norm = norm;
+      period->der_re = 1.0;
+      period->der_im = 0.0;
+    }
+
+  return 0;
+}
+
+// Plain double perturbation, with BLA skipping where the table allows it.
+// With work->period_tolerance set it looks for cycles with
+// render_period_step: a later z back within the tolerance of the saved one
+// while its derivative since the save, the product of 2 z over the steps,
+// is below 1 in magnitude lies on an attracting cycle, so inside the set.
+static void
+render_perturb (const struct render_work *work, double delta_c_re,
+                double delta_c_im, struct render_state *state,
+                long long *rebases)
+{
+  const double escape_radius_sq = ESCAPE_RADIUS * ESCAPE_RADIUS;
+
+  const int max_iter = work->max_iter;
+
+  double delta_z_re = state->dz_re;
+  double delta_z_im = state->dz_im;
+  int iter = state->iter;
+  int iter_orbit = state->iter_orbit;
+  double zn2 = state->zn2;
+
+  const double period_tolerance = work->period_tolerance;
+
+  struct render_period period = state->period;
+
+  state->interior = 0;
+  state->glitch = -1.0;
+
+  while (iter < max_iter)
+    {
+      const struct bla *bla = NULL;
+
+      if (work->bla)
+        bla = bla_table_lookup (work->bla, iter_orbit,
+                                delta_z_re * delta_z_re
+                                    + delta_z_im * delta_z_im,
+                                0, max_iter - iter);
+
+      if (bla)
+        {
+          double temp_re = bla->a_re * delta_z_re - bla->a_im * delta_z_im
+                           + bla->b_re * delta_c_re - bla->b_im * delta_c_im;
+          double temp_im = bla->a_re * delta_z_im + bla->a_im * delta_z_re
+                           + bla->b_re * delta_c_im + bla->b_im * delta_c_re;
+
+          delta_z_re = temp_re;
+          delta_z_im = temp_im;
+
+          // a is the derivative of the skipped steps.
+          if (period_tolerance > 0.0)
+            {
+              double der_temp
+                  = bla->a_re * period.der_re - bla->a_im * period.der_im;
+
+              period.der_im
+                  = bla->a_re * period.der_im + bla->a_im * period.der_re;
+              period.der_re = der_temp;
+            }
+
+          iter_orbit += bla->length;
+          iter += bla->length - 1;
+        }
+      else
+        {
+          double ref_re = work->orbit_re[iter_orbit];
+          double ref_im = work->orbit_im[iter_orbit];
+
+          if (period_tolerance > 0.0)
+            {
+              double z_re = ref_re + delta_z_re;
+              double z_im = ref_im + delta_z_im;
+              double der_temp
+                  = 2.0 * (z_re * period.der_re - z_im * period.der_im);
+
+              period.der_im
+                  = 2.0 * (z_re * period.der_im + z_im * period.der_re);
+              period.der_re = der_temp;
+            }
+
+          double temp_re = 2.0 * (ref_re * delta_z_re - ref_im * delta_z_im);
+          double temp_im = 2.0 * (ref_re * delta_z_im + ref_im * delta_z_re);
+
+          double dz2_re = delta_z_re * delta_z_re - delta_z_im * delta_z_im;
+          double dz2_im = 2.0 * delta_z_re * delta_z_im;
+
+          delta_z_re = temp_re + dz2_re + delta_c_re;
+          delta_z_im = temp_im + dz2_im + delta_c_im;
+
+          iter_orbit++;
+        }
+
+      double z_re = work->orbit_re[iter_orbit] + delta_z_re;
+      double z_im = work->orbit_im[iter_orbit] + delta_z_im;
+
+      if (z_re * z_re + z_im * z_im > escape_radius_sq)
+        break;
+
+      zn2 = z_re * z_re + z_im * z_im;
+
+      double dz_norm = delta_z_re * delta_z_re + delta_z_im * delta_z_im;
+
+      // Past the last entry of the orbit there is nothing to follow, z goes
+      // on from orbit[0] instead.  Where the reference escaped, z is
+      // already beyond ESCAPE_RADIUS / 2 and escapes on the next step.
+      if (dz_norm > zn2 || iter_orbit == work->orbit_escaped)
+        {
+          if (zn2 < work->glitch_tolerance * dz_norm)
+            {
+              state->glitch = zn2 / dz_norm;
+              break;
+            }
+
+          delta_z_re = z_re;
+          delta_z_im = z_im;
+          iter_orbit = 0;
+          (*rebases)++;
+        }
+
+      // After the rebase, which keeps the reference entry within twice z.
+      if (period_tolerance > 0.0
+          && render_period_step (work, &period, work->orbit_re[iter_orbit],
+                                 work->orbit_im[iter_orbit], delta_z_re,
+                                 delta_z_im))
+        {
+          state->interior = 1;
+          iter++;
+          break;
+        }
+
+      iter++;
+    }
+
+  state->period = period;
+  state->dz_re = delta_z_re;
+  state->dz_im = delta_z_im;
+  state->iter = iter;
+  state->iter_orbit = iter_orbit;
+  state->zn2 = zn2;
+}
+
+// Perturbation with the delta kept as mantissas times 2^dz.exp, for deltas
+// below the double range.  Runs until the delta is back in range and returns
+// 1 when render_perturb should take over from there.  Looks for cycles as
+// that does, where z is the reference unless that passes by zero.
+static int
+render_perturb_floatexp (const struct render_work *work,
+                         struct floatexp_complex delta_c,
+                         struct render_state *state, long long *rebases)
+{
+  const double escape_radius_sq = ESCAPE_RADIUS * ESCAPE_RADIUS;
+
+  const int max_iter = work->max_iter;
+
+  struct floatexp_complex dz = { state->dz_re, state->dz_im, state->dz_exp };
+
+  // dz^2 * 2^exp and delta_c * 2^-exp, refreshed whenever dz.exp moves,
+  // and dz in z for the cycle search, left out below the normal doubles.
+  double dz2_scale = ldexp (1.0, dz.exp);
+  double dc_re = ldexp (delta_c.re, delta_c.exp - dz.exp);
+  double dc_im = ldexp (delta_c.im, delta_c.exp - dz.exp);
+  double dz_scale = dz.exp >= DBL_MIN_EXP ? dz2_scale : 0.0;
+
+  int iter = state->iter;
+  int iter_orbit = state->iter_orbit;
+  double zn2 = state->zn2;
+
+  const double period_tolerance = work->period_tolerance;
+
+  struct render_period period = state->period;
+
+  while (iter < max_iter)
+    {
+      const struct bla *bla = NULL;
+
+      if (work->bla)
+        bla = bla_table_lookup (work->bla, iter_orbit,
+                                dz.re * dz.re + dz.im * dz.im, dz.exp,
+                                max_iter - iter);
+
+      if (bla)
+        {
+          double temp_re = bla->a_re * dz.re - bla->a_im * dz.im
+                           + bla->b_re * dc_re - bla->b_im * dc_im;
+          double temp_im = bla->a_re * dz.im + bla->a_im * dz.re
+                           + bla->b_re * dc_im + bla->b_im * dc_re;
+
+          dz.re = temp_re;
+          dz.im = temp_im;
+
+          if (period_tolerance > 0.0)
+            {
+              double der_temp
+                  = bla->a_re * period.der_re - bla->a_im * period.der_im;
+
+              period.der_im
+                  = bla->a_re * period.der_im + bla->a_im * period.der_re;
+              period.der_re = der_temp;
+            }
+
+          iter_orbit += bla->length;
+          iter += bla->length - 1;
+        }
+      else
+        {
+          double ref_re = work->orbit_re[iter_orbit];
+          double ref_im = work->orbit_im[iter_orbit];
+
+          if (period_tolerance > 0.0)
+            {
+              double z_re = ref_re + dz.re * dz_scale;
+              double z_im = ref_im + dz.im * dz_scale;
+              double der_temp
+                  = 2.0 * (z_re * period.der_re - z_im * period.der_im);
+
+              period.der_im
+                  = 2.0 * (z_re * period.der_im + z_im * period.der_re);
+              period.der_re = der_temp;
+            }
+
+          double temp_re = 2.0 * (ref_re * dz.re - ref_im * dz.im);
+          double temp_im = 2.0 * (ref_re * dz.im + ref_im * dz.re);
+
+          double dz2_re = (dz.re * dz.re - dz.im * dz.im) * dz2_scale;
+          double dz2_im = 2.0 * dz.re * dz.im * dz2_scale;
+
+          dz.re = temp_re + dz2_re + dc_re;
+          dz.im = temp_im + dz2_im + dc_im;
+
+          iter_orbit++;
+        }
+
+      // The delta is far below the reference, so z is the reference itself
+      // unless the reference passes right by zero.
+      double ref_re = work->orbit_re[iter_orbit];
+      double ref_im = work->orbit_im[iter_orbit];
+      double ref_norm = ref_re * ref_re + ref_im * ref_im;
+
+      if (ref_norm > escape_radius_sq)
+        break;
+
+      zn2 = ref_norm;
+
+      // As in render_perturb; z is the reference to within the delta, back
+      // in the double range, so render_perturb takes over.
+      if (iter_orbit == work->orbit_escaped)
+        {
+          dz.re = ref_re + ldexp (dz.re, dz.exp);
+          dz.im = ref_im + ldexp (dz.im, dz.exp);
+          dz.exp = 0;
+          iter_orbit = 0;
+          (*rebases)++;
+          iter++;
+          break;
+        }
+
+      if (fabs (ref_re) < FLOATEXP_REBASE_LIMIT
+          && fabs (ref_im) < FLOATEXP_REBASE_LIMIT)
+        {
+          double z_re = ldexp (ref_re, -dz.exp) + dz.re;
+          double z_im = ldexp (ref_im, -dz.exp) + dz.im;
+          double dz_norm = dz.re * dz.re + dz.im * dz.im;
+          double z_norm = z_re * z_re + z_im * z_im;
+
+          if (dz_norm > z_norm && z_norm < work->glitch_tolerance * dz_norm)
+            {
+              state->glitch = z_norm / dz_norm;
+              break;
+            }
+
+          if (dz_norm > z_norm)
+            {
+              dz.re = z_re;
+              dz.im = z_im;
+              iter_orbit = 0;
+              (*rebases)++;
+            }
+        }
+
+      if (period_tolerance > 0.0
+          && render_period_step (work, &period, work->orbit_re[iter_orbit],
+                                 work->orbit_im[iter_orbit],
+                                 dz.re * dz_scale, dz.im * dz_scale))
+        {
+          state->interior = 1;
+          iter++;
+          break;
+        }
+
+      iter++;
+
+      if (floatexp_complex_drifted (&dz))
+        {
+          floatexp_complex_normalize (&dz);
+
+          if (dz.exp >= FLOATEXP_SWITCH_EXP)
+            break;
+
+          dz2_scale = ldexp (1.0, dz.exp);
+          dc_re = ldexp (delta_c.re, delta_c.exp - dz.exp);
+          dc_im = ldexp (delta_c.im, delta_c.exp - dz.exp);
+          dz_scale = dz.exp >= DBL_MIN_EXP ? dz2_scale : 0.0;
+        }
+    }
+
+  int handover = iter < max_iter && !state->interior && state->glitch < 0.0
+                 && dz.exp >= FLOATEXP_SWITCH_EXP;
+
+  state->period = period;
+
+  // Pixels left at max_iter keep the scaled delta, to be resumed from.
+  state->dz_re = handover ? ldexp (dz.re, dz.exp) : dz.re;
+  state->dz_im = handover ? ldexp (dz.im, dz.exp) : dz.im;
+  state->dz_exp = handover ? 0 : dz.exp;
+  state->iter = iter;
+  state->iter_orbit = iter_orbit;
+  state->zn2 = zn2;
+
+  return handover;
+}
+
+// The palette presets, picked at runtime with render_set_coloring.
+static const uint32_t render_palette_contrast[]
+    = { 0xFF000000, 0xFF7877EE, 0xFF180719, 0xFFC5421C, 0xFF1D120B,
+        0xFF872E47, 0xFF181B0D, 0xFFF1E680, 0xFF111F18, 0xFFF0A28B,
+        0xFF0B041E, 0xFF6A57BD, 0xFF1D150E, 0xFF0C8C76, 0xFF0A061D,
+        0xFF32904D, 0xFF160018, 0xFF94BCF3, 0xFF042007, 0xFFE7920E,
+        0xFF0A0D14, 0xFFB89344, 0xFF0D1C03, 0xFFA9F898, 0xFF040022,
+        0xFF3E5330, 0xFF071516, 0xFF9861B8, 0xFF08030C, 0xFFF75CEB,
+        0xFF1F2010 };
+
+static const uint32_t render_palette_lavender[] = {
+  0xFF000000, 0xFF1A0A5E, 0xFF3D1F99, 0xFF5C44C3, 0xFF7C68E5,
+  0xFF9AA1F1, 0xFFB7BCFA, 0xFFDFE5FF, 0xFFB1C1D9, 0xFF7D91BF,
+  0xFF4C65A7, 0xFF1F3D88, 0xFF0A1A5E,
+};
+
+static const uint32_t render_palette_moss[] = {
+  0xFFBCCAB3, 0xFF94A98F, 0xFF6E8B6C, 0xFF516A52,
+  0xFF3C4F3E, 0xFF2D3A2F, 0xFF1F2A22,
+};
+
+static const uint32_t render_palette_ochre[] = {
+  0xFFA9391F, 0xFFA68921, 0xFF59601F, 0xFF735615, 0xFF403F14, 0xFFAD5621,
+  0xFF312D0C, 0xFFF7E847, 0xFFE3BB30, 0xFF513C0E, 0xFF8E7F21, 0xFF783411,
+  0xFF742013, 0xFFD5B15B, 0xFF90963D, 0xFF5B4F16, 0xFF816F1D, 0xFF54210B,
+  0xFF88765F, 0xFFCCB92E, 0xFF140F05, 0xFF814C42, 0xFFC0A87C, 0xFF341F07,
+  0xFF53110B, 0xFFF9EB83, 0xFF5B4235, 0xFF7A5A2E, 0xFF170404, 0xFF8F5615,
+  0xFF3F2A1E, 0xFF512C0B, 0xFFC98A19, 0xFF64390E, 0xFF3F1C07, 0xFF241C06,
+  0xFF345E10, 0xFF432D2C, 0xFF241405, 0xFF291F1C, 0xFF3E0B06, 0xFFBADC46,
+  // 0xFFAC446C,
+  0xFF0B1405,
+};
+
+struct render_palette
+{
+  const uint32_t *colors;
+  int amount;
+};
+
+#define RENDER_PALETTE(colors) { colors, sizeof colors / sizeof colors[0] }
+
+static const struct render_palette g_palettes[] = {
+  RENDER_PALETTE (render_palette_contrast),
+  RENDER_PALETTE (render_palette_lavender),
+  RENDER_PALETTE (render_palette_moss),
+  RENDER_PALETTE (render_palette_ochre),
+};
+
+static const int g_palettes_amount = sizeof g_palettes / sizeof g_palettes[0];
+
+// The coloring as of the last render_set_coloring, which bumps
+// g_coloring_version after it: tiles painting meanwhile see it moved and
+// paint again, see render_paint, so none is left behind the recoloring pass
+// that follows.
+static atomic_int g_coloring_palette;
+static _Atomic double g_coloring_frequency = 0.1;
+static _Atomic double g_coloring_offset;
+static atomic_int g_coloring_version;
+
+struct render_coloring
+{
+  const struct render_palette *palette;
+  double frequency;
+  double offset;
+};
+
+static void
+render_coloring_load (struct render_coloring *coloring)
+{
+  coloring->palette = &g_palettes[atomic_load (&g_coloring_palette)];
+  coloring->frequency = atomic_load (&g_coloring_frequency);
+  coloring->offset = atomic_load (&g_coloring_offset);
+}
+
+// What goes into pixels_smooth for an escaped pixel, from its final |z|^2.
+static float
+render_smooth (double zn2)
+{
+  return 1 - log2 (log2 (sqrt (zn2)));
+}
+
+// The color of a pixel from its pixels_iter and pixels_smooth.
+static uint32_t
+render_color (const struct render_coloring *coloring, int iter, float smooth)
+{
+  if (iter < 0)
+    return iter == -1 ? 0xFF000000 : 0;
+
+  const struct render_palette *palette = coloring->palette;
+
+  double t = (iter + smooth) * coloring->frequency + coloring->offset;
+
+  t = t - floor (t / palette->amount) * palette->amount;
+
+  int idx = (int)t;
+  double frac = t - idx;
+
+  uint32_t c1 = palette->colors[idx % palette->amount];
+  uint32_t c2 = palette->colors[(idx + 1) % palette->amount];
+
+  return interpolate_color (c1, c2, frac);
+}
+
+// The color of pixel index, averaged over all of its samples where it has
+// more than one.
+static uint32_t
+render_pixel_color (const struct render_coloring *coloring, size_t index)
+{
+  uint32_t color = render_color (
+      coloring,
+      atomic_load_explicit (&pixels_iter[index], memory_order_relaxed),
+      atomic_load_explicit (&pixels_smooth[index], memory_order_relaxed));
+
+  int amount = atomic_load_explicit (&g_samples_amount[index],
+                                     memory_order_acquire);
+
+  if (!amount)
+    return color;
+
+  const struct render_sample *samples
+      = &g_samples[index * (RENDER_SAMPLES_MAX - 1)];
+
+  uint32_t r = (color >> 16) & 0xFF;
+  uint32_t g = (color >> 8) & 0xFF;
+  uint32_t b = color & 0xFF;
+
+  for (int s = 0; s < amount; ++s)
+    {
+      color = render_color (coloring, samples[s].iter, samples[s].smooth);
+
+      r += (color >> 16) & 0xFF;
+      g += (color >> 8) & 0xFF;
+      b += color & 0xFF;
+    }
+
+  amount++;
+
+  return 0xFF000000 | (r / amount) << 16 | (g / amount) << 8 | b / amount;
+}
+
+// Paints pixel index from its pixels_iter, pixels_smooth and samples, once
+// they are stored, in the coloring of *version.  A recoloring started
+// meanwhile either has its version seen after the fence, and the pixel is
+// painted again in its colors, or fences later itself and paints over the
+// color stored here from the values stored before it.
+static void
+render_paint (struct render_coloring *coloring, int *version, size_t index)
+{
+  atomic_store_explicit (&pixels[index], render_pixel_color (coloring, index),
+                         memory_order_relaxed);
+
+  atomic_thread_fence (memory_order_seq_cst);
+
+  int current = atomic_load_explicit (&g_coloring_version,
+                                      memory_order_relaxed);
+
+  if (current == *version)
+    return;
+
+  *version = current;
+  render_coloring_load (coloring);
+
+  atomic_store_explicit (&pixels[index], render_pixel_color (coloring, index),
+                         memory_order_relaxed);
+}
+
+// Puts back the pixels_iter and pixels_smooth of pixel index from what was
+// stored for it, once render_done_final holds.
+static void
+render_done_restore (int generation, size_t index)
+{
+  double zn2 = 0.0;
+  int iter = render_done_load (generation, index, &zn2);
+
+  // Stored with a state where it stopped at max_iter, see render_flush.
+  if (pixels_state[index].iter != -1)
+    {
+      atomic_store_explicit (&pixels_iter[index], -1, memory_order_relaxed);
+      atomic_store_explicit (&pixels_smooth[index], 0.0f,
+                             memory_order_relaxed);
+    }
+  else
+    {
+      atomic_store_explicit (&pixels_iter[index], iter,
+                             memory_order_relaxed);
+      atomic_store_explicit (&pixels_smooth[index], render_smooth (zn2),
+                             memory_order_relaxed);
+    }
+}
+
+// Pixels of a tile are collected into batches, so the lane kernels always
+// have a few pixels at hand to refill a lane the moment it finishes.
+#define RENDER_BATCH 64
+
+// Pixels with todo set are iterated from the state next to it: dz is scaled
+// by 2^dz_exp, which is 0 unless the delta is below the double range.
+struct render_batch
+{
+  int count;
+  int x[RENDER_BATCH];
+  int y[RENDER_BATCH];
+  double dc_re[RENDER_BATCH];
+  double dc_im[RENDER_BATCH];
+  int todo[RENDER_BATCH];
+  double dz_re[RENDER_BATCH];
+  double dz_im[RENDER_BATCH];
+  long dz_exp[RENDER_BATCH];
+  int iter[RENDER_BATCH];
+  int iter_orbit[RENDER_BATCH];
+  double zn2[RENDER_BATCH];
+  int interior[RENDER_BATCH];
+  double glitch[RENDER_BATCH];
+  // Set where the pixel was last iterated against a secondary reference,
+  // see render_batch_deglitch.
+  int secondary[RENDER_BATCH];
+  // delta_c in units of work->scale, for deltas below the double range.
+  double dc_x[RENDER_BATCH];
+  double dc_y[RENDER_BATCH];
+  // Which of the extra samples of its pixel it is, for render_supersample.
+  int sample[RENDER_BATCH];
+};
+
+#define RENDER_LANES_MAX 16
+
+// Lane state lives in these arrays while a lane is refilled, and in vector
+// registers while iterating.  The cycle check of render_perturb starts the
+// saves of all lanes over at once, period_window steps after the last time.
+struct render_lanes
+{
+  double dc_re[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double dc_im[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double dz_re[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double dz_im[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double iter[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double iter_orbit[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double zn2[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double saved_re[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double saved_im[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double saved_ref_re[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double saved_ref_im[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double saved_norm[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double der_re[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double der_im[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double interior[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  double glitch[RENDER_LANES_MAX] __attribute__ ((aligned (64)));
+  int pixel[RENDER_LANES_MAX];
+  int next;
+  int period_step;
+  int period_window;
+};
+
+// Retire the finished lanes in done (a bit per lane) into the batch and load
+// the next pending pixels into them.  Returns the mask of lanes that still
+// have a pixel.
+static int
+render_lanes_refill (struct render_lanes *lanes, struct render_batch *batch,
+                     int done, int width, int max_iter)
+{
+  int live = 0;
+
+  for (int i = 0; i < width; ++i)
+    {
+      if (done & (1 << i))
+        {
+          int p = lanes->pixel[i];
+
+          if (p >= 0)
+            {
+              batch->dz_re[p] = lanes->dz_re[i];
+              batch->dz_im[p] = lanes->dz_im[i];
+              batch->iter[p] = lanes->iter[i];
+              batch->iter_orbit[p] = lanes->iter_orbit[i];
+              batch->zn2[p] = lanes->zn2[i];
+              batch->interior[p] = lanes->interior[i] != 0.0;
+              batch->glitch[p] = lanes->glitch[i];
+            }
+
+          // Idle lanes still gather the reference, keep them in bounds.
+          lanes->pixel[i] = -1;
+          lanes->iter[i] = max_iter;
+          lanes->iter_orbit[i] = 0;
+
+          while (lanes->next < batch->count && !batch->todo[lanes->next])
+            lanes->next++;
+
+          if (lanes->next < batch->count)
+            {
+              p = lanes->next++;
+
+              lanes->pixel[i] = p;
+              lanes->dc_re[i] = batch->dc_re[p];
+              lanes->dc_im[i] = batch->dc_im[p];
+              lanes->dz_re[i] = batch->dz_re[p];
+              lanes->dz_im[i] = batch->dz_im[p];
+              lanes->iter[i] = batch->iter[p];
+              lanes->iter_orbit[i] = batch->iter_orbit[p];
+              lanes->zn2[i] = batch->zn2[p];
+
+              // Saved on the next step.
+              lanes->saved_re[i] = NAN;
+              lanes->saved_im[i] = NAN;
+              lanes->saved_ref_re[i] = NAN;
+              lanes->saved_ref_im[i] = NAN;
+              lanes->saved_norm[i] = INFINITY;
+              lanes->der_re[i] = 1.0;
+              lanes->der_im[i] = 0.0;
+              lanes->interior[i] = 0.0;
+              lanes->glitch[i] = -1.0;
+            }
+        }
+
+      if (lanes->pixel[i] >= 0)
+        live |= 1 << i;
+    }
+
+  return live;
+}
+
+// One group of lanes of the AVX2 kernel.
+struct render_group_avx2
+{
+  __m256d dc_re;
+  __m256d dc_im;
+  __m256d dz_re;
+  __m256d dz_im;
+  __m256d iter;
+  __m256d iter_orbit;
+  __m256d zn2;
+  __m256d ref_re;
+  __m256d ref_im;
+  __m256d active;
+  __m256d rebases;
+  __m256d z_re;
+  __m256d z_im;
+  __m256d saved_re;
+  __m256d saved_im;
+  __m256d saved_ref_re;
+  __m256d saved_ref_im;
+  __m256d saved_norm;
+  __m256d der_re;
+  __m256d der_im;
+  __m256d interior;
+  __m256d glitch;
+};
+
+__attribute__ ((target ("avx2"), always_inline)) static inline void
+render_group_load_avx2 (const struct render_work *work,
+                        const struct render_lanes *lanes, int offset,
+                        struct render_group_avx2 *g, int direct)
+{
+  g->dc_re = _mm256_load_pd (lanes->dc_re + offset);
+  g->dc_im = _mm256_load_pd (lanes->dc_im + offset);
+  g->dz_re = _mm256_load_pd (lanes->dz_re + offset);
+  g->dz_im = _mm256_load_pd (lanes->dz_im + offset);
+  g->iter = _mm256_load_pd (lanes->iter + offset);
+  g->iter_orbit = _mm256_load_pd (lanes->iter_orbit + offset);
+  g->zn2 = _mm256_load_pd (lanes->zn2 + offset);
+
+  // The reference at iter_orbit, carried over from step to step.
+  if (direct)
+    {
+      g->ref_re = _mm256_setzero_pd ();
+      g->ref_im = _mm256_setzero_pd ();
+    }
+  else
+    {
+      __m128i index = _mm256_cvttpd_epi32 (g->iter_orbit);
+      g->ref_re = _mm256_i32gather_pd (work->orbit_re, index, 8);
+      g->ref_im = _mm256_i32gather_pd (work->orbit_im, index, 8);
+    }
+
+  g->active = _mm256_cmp_pd (g->iter, _mm256_set1_pd (work->max_iter),
+                             _CMP_LT_OQ);
+
+  g->z_re = _mm256_add_pd (g->ref_re, g->dz_re);
+  g->z_im = _mm256_add_pd (g->ref_im, g->dz_im);
+  g->saved_re = _mm256_load_pd (lanes->saved_re + offset);
+  g->saved_im = _mm256_load_pd (lanes->saved_im + offset);
+  g->saved_ref_re = _mm256_load_pd (lanes->saved_ref_re + offset);
+  g->saved_ref_im = _mm256_load_pd (lanes->saved_ref_im + offset);
+  g->saved_norm = _mm256_load_pd (lanes->saved_norm + offset);
+  g->der_re = _mm256_load_pd (lanes->der_re + offset);
+  g->der_im = _mm256_load_pd (lanes->der_im + offset);
+  g->interior = _mm256_load_pd (lanes->interior + offset);
+  g->glitch = _mm256_load_pd (lanes->glitch + offset);
+}
+
+__attribute__ ((target ("avx2"), always_inline)) static inline void
+render_group_store_avx2 (struct render_lanes *lanes, int offset,
+                         const struct render_group_avx2 *g)
+{
+  _mm256_store_pd (lanes->dz_re + offset, g->dz_re);
+  _mm256_store_pd (lanes->dz_im + offset, g->dz_im);
+  _mm256_store_pd (lanes->iter + offset, g->iter);
+  _mm256_store_pd (lanes->iter_orbit + offset, g->iter_orbit);
+  _mm256_store_pd (lanes->zn2 + offset, g->zn2);
+  _mm256_store_pd (lanes->saved_re + offset, g->saved_re);
+  _mm256_store_pd (lanes->saved_im + offset, g->saved_im);
+  _mm256_store_pd (lanes->saved_ref_re + offset, g->saved_ref_re);
+  _mm256_store_pd (lanes->saved_ref_im + offset, g->saved_ref_im);
+  _mm256_store_pd (lanes->saved_norm + offset, g->saved_norm);
+  _mm256_store_pd (lanes->der_re + offset, g->der_re);
+  _mm256_store_pd (lanes->der_im + offset, g->der_im);
+  _mm256_store_pd (lanes->interior + offset, g->interior);
+  _mm256_store_pd (lanes->glitch + offset, g->glitch);
+}
+
+// With periodic set, which is a constant where this is inlined, also the
+// cycle check of render_perturb, starting the saves over when save is set.
+// With direct set, also a constant, the reference is the orbit of 0: dz is
+// z, and the orbit is neither gathered nor rebased onto.
+__attribute__ ((target ("avx2"), always_inline)) static inline void
+render_group_step_avx2 (const struct render_work *work,
+                        struct render_group_avx2 *g, int periodic, int save,
+                        int direct)
+{
+  const __m256d escape_radius_sq
+      = _mm256_set1_pd (ESCAPE_RADIUS * ESCAPE_RADIUS);
+  const __m256d orbit_escaped = _mm256_set1_pd (work->orbit_escaped);
+  const __m256d max_iter = _mm256_set1_pd (work->max_iter);
+  const __m256d zero = _mm256_setzero_pd ();
+  const __m256d one = _mm256_set1_pd (1.0);
+  const __m256d two = _mm256_set1_pd (2.0);
+
+  if (periodic)
+    {
+      __m256d der_re = _mm256_sub_pd (_mm256_mul_pd (g->z_re, g->der_re),
+                                      _mm256_mul_pd (g->z_im, g->der_im));
+      __m256d der_im = _mm256_add_pd (_mm256_mul_pd (g->z_re, g->der_im),
+                                      _mm256_mul_pd (g->z_im, g->der_re));
+
+      g->der_re = _mm256_mul_pd (two, der_re);
+      g->der_im = _mm256_mul_pd (two, der_im);
+    }
+
+  __m256d dz2_re = _mm256_sub_pd (_mm256_mul_pd (g->dz_re, g->dz_re),
+                                  _mm256_mul_pd (g->dz_im, g->dz_im));
+  __m256d dz2_im = _mm256_mul_pd (_mm256_mul_pd (two, g->dz_re), g->dz_im);
+
+  __m256d next_re = dz2_re;
+  __m256d next_im = dz2_im;
+
+  if (!direct)
+    {
+      __m256d temp_re = _mm256_sub_pd (_mm256_mul_pd (g->ref_re, g->dz_re),
+                                       _mm256_mul_pd (g->ref_im, g->dz_im));
+      __m256d temp_im = _mm256_add_pd (_mm256_mul_pd (g->ref_re, g->dz_im),
+                                       _mm256_mul_pd (g->ref_im, g->dz_re));
+
+      temp_re = _mm256_mul_pd (two, temp_re);
+      temp_im = _mm256_mul_pd (two, temp_im);
+
+      next_re = _mm256_add_pd (temp_re, dz2_re);
+      next_im = _mm256_add_pd (temp_im, dz2_im);
+    }
+
+  next_re = _mm256_add_pd (next_re, g->dc_re);
+  next_im = _mm256_add_pd (next_im, g->dc_im);
+
+  g->dz_re = _mm256_blendv_pd (g->dz_re, next_re, g->active);
+  g->dz_im = _mm256_blendv_pd (g->dz_im, next_im, g->active);
+
+  __m256d z_re = g->dz_re;
+  __m256d z_im = g->dz_im;
+
+  if (!direct)
+    {
+      g->iter_orbit = _mm256_blendv_pd (
+          g->iter_orbit, _mm256_add_pd (g->iter_orbit, one), g->active);
+
+      __m128i index = _mm256_cvttpd_epi32 (g->iter_orbit);
+      g->ref_re = _mm256_i32gather_pd (work->orbit_re, index, 8);
+      g->ref_im = _mm256_i32gather_pd (work->orbit_im, index, 8);
+
+      z_re = _mm256_add_pd (g->ref_re, g->dz_re);
+      z_im = _mm256_add_pd (g->ref_im, g->dz_im);
+    }
+
+  __m256d z_norm
+      = _mm256_add_pd (_mm256_mul_pd (z_re, z_re), _mm256_mul_pd (z_im, z_im));
+
+  __m256d escaped = _mm256_and_pd (
+      g->active, _mm256_cmp_pd (z_norm, escape_radius_sq, _CMP_GT_OQ));
+  __m256d alive = _mm256_andnot_pd (escaped, g->active);
+
+  g->zn2 = _mm256_blendv_pd (g->zn2, z_norm, alive);
+
+  if (!direct)
+    {
+      __m256d dz_norm = _mm256_add_pd (_mm256_mul_pd (g->dz_re, g->dz_re),
+                                       _mm256_mul_pd (g->dz_im, g->dz_im));
+
+      __m256d rebase = _mm256_and_pd (
+          alive, _mm256_or_pd (_mm256_cmp_pd (dz_norm, z_norm, _CMP_GT_OQ),
+                               _mm256_cmp_pd (g->iter_orbit, orbit_escaped,
+                                              _CMP_EQ_OQ)));
+
+      // Glitched lanes stop, as in render_perturb.
+      const __m256d glitch_tolerance
+          = _mm256_set1_pd (work->glitch_tolerance);
+
+      __m256d glitched = _mm256_and_pd (
+          rebase, _mm256_cmp_pd (z_norm,
+                                 _mm256_mul_pd (glitch_tolerance, dz_norm),
+                                 _CMP_LT_OQ));
+
+      if (_mm256_movemask_pd (glitched))
+        {
+          g->glitch = _mm256_blendv_pd (
+              g->glitch, _mm256_div_pd (z_norm, dz_norm), glitched);
+          g->active = _mm256_andnot_pd (glitched, g->active);
+        }
+
+      // Rebased lanes restart at orbit[0], which is always zero.
+      g->dz_re = _mm256_blendv_pd (g->dz_re, z_re, rebase);
+      g->dz_im = _mm256_blendv_pd (g->dz_im, z_im, rebase);
+      g->iter_orbit = _mm256_blendv_pd (g->iter_orbit, zero, rebase);
+      g->ref_re = _mm256_blendv_pd (g->ref_re, zero, rebase);
+      g->ref_im = _mm256_blendv_pd (g->ref_im, zero, rebase);
+
+      g->rebases = _mm256_add_pd (g->rebases, _mm256_and_pd (rebase, one));
+    }
+
+  __m256d stepped = _mm256_andnot_pd (escaped, g->active);
+
+  g->iter = _mm256_blendv_pd (g->iter, _mm256_add_pd (g->iter, one), stepped);
+
+  g->active = _mm256_and_pd (stepped,
+                             _mm256_cmp_pd (g->iter, max_iter, _CMP_LT_OQ));
+
+  if (periodic)
+    {
+      const __m256d period_tolerance
+          = _mm256_set1_pd (work->period_tolerance);
+
+      // After the rebase, as in render_period_step.
+      __m256d diff_re = _mm256_sub_pd (g->dz_re, g->saved_re);
+      __m256d diff_im = _mm256_sub_pd (g->dz_im, g->saved_im);
+
+      if (!direct)
+        {
+          diff_re = _mm256_add_pd (_mm256_sub_pd (g->ref_re, g->saved_ref_re),
+                                   diff_re);
+          diff_im = _mm256_add_pd (_mm256_sub_pd (g->ref_im, g->saved_ref_im),
+                                   diff_im);
+        }
+
+      __m256d diff_norm = _mm256_add_pd (_mm256_mul_pd (diff_re, diff_re),
+                                         _mm256_mul_pd (diff_im, diff_im));
+      __m256d der_norm = _mm256_add_pd (_mm256_mul_pd (g->der_re, g->der_re),
+                                        _mm256_mul_pd (g->der_im, g->der_im));
+      __m256d contraction = _mm256_sub_pd (one, der_norm);
+      __m256d bound = _mm256_mul_pd (
+          _mm256_mul_pd (period_tolerance, g->saved_norm),
+          _mm256_mul_pd (contraction, contraction));
+
+      __m256d inside = _mm256_and_pd (
+          _mm256_and_pd (alive, _mm256_cmp_pd (contraction, zero,
+                                               _CMP_GT_OQ)),
+          _mm256_cmp_pd (_mm256_mul_pd (_mm256_set1_pd (4.0), diff_norm),
+                         bound, _CMP_LT_OQ));
+
+      g->interior = _mm256_or_pd (g->interior, _mm256_and_pd (inside, one));
+      g->active = _mm256_andnot_pd (inside, g->active);
+
+      g->z_re = z_re;
+      g->z_im = z_im;
+
+      if (save)
+        g->saved_norm = _mm256_set1_pd (INFINITY);
+
+      __m256d lower = _mm256_cmp_pd (z_norm, g->saved_norm, _CMP_LT_OQ);
+
+      g->saved_re = _mm256_blendv_pd (g->saved_re, g->dz_re, lower);
+      g->saved_im = _mm256_blendv_pd (g->saved_im, g->dz_im, lower);
+      g->saved_ref_re = _mm256_blendv_pd (g->saved_ref_re, g->ref_re, lower);
+      g->saved_ref_im = _mm256_blendv_pd (g->saved_ref_im, g->ref_im, lower);
+      g->saved_norm = _mm256_blendv_pd (g->saved_norm, z_norm, lower);
+      g->der_re = _mm256_blendv_pd (g->der_re, one, lower);
+      g->der_im = _mm256_blendv_pd (g->der_im, zero, lower);
+    }
+}
+
+// Steps on to the next start of the saves of the cycle check in lanes and
+// tells whether this step is it.
+static inline int
+render_lanes_save (struct render_lanes *lanes)
+{
+  if (++lanes->period_step < lanes->period_window)
+    return 0;
+
+  lanes->period_step = 0;
+
+  if (lanes->period_window < 1 << 30)
+    lanes->period_window *= 2;
+
+  return 1;
+}
+
+static void
+render_lanes_init (struct render_lanes *lanes, int width)
+{
+  lanes->next = 0;
+  lanes->period_step = 0;
+  lanes->period_window = 1;
+
+  for (int i = 0; i < width; ++i)
+    {
+      lanes->pixel[i] = -1;
+      lanes->saved_re[i] = NAN;
+      lanes->saved_im[i] = NAN;
+      lanes->saved_ref_re[i] = NAN;
+      lanes->saved_ref_im[i] = NAN;
+      lanes->saved_norm[i] = INFINITY;
+      lanes->der_re[i] = 1.0;
+      lanes->der_im[i] = 0.0;
+      lanes->interior[i] = 0.0;
+      lanes->glitch[i] = -1.0;
+    }
+}
+
+// The perturbation step of render_perturb without BLA, on two groups of four
+// pixels.  Every lane has its own orbit index, so rebasing stays per pixel;
+// the two groups are independent, which hides the latency of the gathers.
+__attribute__ ((target ("avx2"), always_inline)) static inline int
+render_perturb_avx2_run (const struct render_work *work,
+                         struct render_batch *batch, long long *rebases,
+                         int periodic, int direct)
+{
+  struct render_lanes lanes;
+  struct render_group_avx2 a, b;
+
+  render_lanes_init (&lanes, 8);
+
+  a.rebases = _mm256_setzero_pd ();
+  b.rebases = _mm256_setzero_pd ();
+
+  int live = render_lanes_refill (&lanes, batch, 0xFF, 8, work->max_iter);
+
+  while (live)
+    {
+      render_group_load_avx2 (work, &lanes, 0, &a, direct);
+      render_group_load_avx2 (work, &lanes, 4, &b, direct);
+
+      int done = 0;
+
+      while (!done)
+        {
+          int save = periodic && render_lanes_save (&lanes);
+
+          render_group_step_avx2 (work, &a, periodic, save, direct);
+          render_group_step_avx2 (work, &b, periodic, save, direct);
+
+          int active = _mm256_movemask_pd (a.active)
+                       | _mm256_movemask_pd (b.active) << 4;
+
+          done = live & ~active;
+        }
+
+      render_group_store_avx2 (&lanes, 0, &a);
+      render_group_store_avx2 (&lanes, 4, &b);
+
+      if (work->generation != atomic_load (&g_generation))
+        return 0;
+
+      live = render_lanes_refill (&lanes, batch, done, 8, work->max_iter);
+    }
+
+  double counts[4];
+  _mm256_storeu_pd (counts, _mm256_add_pd (a.rebases, b.rebases));
+
+  *rebases += counts[0] + counts[1] + counts[2] + counts[3];
+
+  return 1;
+}
+
+// The cycle check costs a good part of a step, and the orbit of 0 saves
+// most of one, so each gets its own copy.
+__attribute__ ((target ("avx2"))) static int
+render_perturb_avx2 (const struct render_work *work,
+                     struct render_batch *batch, long long *rebases)
+{
+  if (work->direct && work->period_tolerance > 0.0)
+    return render_perturb_avx2_run (work, batch, rebases, 1, 1);
+
+  if (work->direct)
+    return render_perturb_avx2_run (work, batch, rebases, 0, 1);
+
+  if (work->period_tolerance > 0.0)
+    return render_perturb_avx2_run (work, batch, rebases, 1, 0);
+
+  return render_perturb_avx2_run (work, batch, rebases, 0, 0);
+}
+
+// One group of lanes of the AVX-512 kernel.
+struct render_group_avx512
+{
+  __m512d dc_re;
+  __m512d dc_im;
+  __m512d dz_re;
+  __m512d dz_im;
+  __m512d iter;
+  __m512d iter_orbit;
+  __m512d zn2;
+  __m512d ref_re;
+  __m512d ref_im;
+  __m512d rebases;
+  __m512d z_re;
+  __m512d z_im;
+  __m512d saved_re;
+  __m512d saved_im;
+  __m512d saved_ref_re;
+  __m512d saved_ref_im;
+  __m512d saved_norm;
+  __m512d der_re;
+  __m512d der_im;
+  __m512d interior;
+  __m512d glitch;
+  __mmask8 active;
+};
+
+__attribute__ ((target ("avx512f"), always_inline)) static inline void
+render_group_load_avx512 (const struct render_work *work,
+                          const struct render_lanes *lanes, int offset,
+                          struct render_group_avx512 *g, int direct)
+{
+  g->dc_re = _mm512_load_pd (lanes->dc_re + offset);
+  g->dc_im = _mm512_load_pd (lanes->dc_im + offset);
+  g->dz_re = _mm512_load_pd (lanes->dz_re + offset);
+  g->dz_im = _mm512_load_pd (lanes->dz_im + offset);
+  g->iter = _mm512_load_pd (lanes->iter + offset);
+  g->iter_orbit = _mm512_load_pd (lanes->iter_orbit + offset);
+  g->zn2 = _mm512_load_pd (lanes->zn2 + offset);
+
+  // The reference at iter_orbit, carried over from step to step.
+  if (direct)
+    {
+      g->ref_re = _mm512_setzero_pd ();
+      g->ref_im = _mm512_setzero_pd ();
+    }
+  else
+    {
+      __m256i index = _mm512_cvttpd_epi32 (g->iter_orbit);
+      g->ref_re = _mm512_i32gather_pd (index, work->orbit_re, 8);
+      g->ref_im = _mm512_i32gather_pd (index, work->orbit_im, 8);
+    }
+
+  g->active = _mm512_cmp_pd_mask (g->iter, _mm512_set1_pd (work->max_iter),
+                                  _CMP_LT_OQ);
+
+  g->z_re = _mm512_add_pd (g->ref_re, g->dz_re);
+  g->z_im = _mm512_add_pd (g->ref_im, g->dz_im);
+  g->saved_re = _mm512_load_pd (lanes->saved_re + offset);
+  g->saved_im = _mm512_load_pd (lanes->saved_im + offset);
+  g->saved_ref_re = _mm512_load_pd (lanes->saved_ref_re + offset);
+  g->saved_ref_im = _mm512_load_pd (lanes->saved_ref_im + offset);
+  g->saved_norm = _mm512_load_pd (lanes->saved_norm + offset);
+  g->der_re = _mm512_load_pd (lanes->der_re + offset);
+  g->der_im = _mm512_load_pd (lanes->der_im + offset);
+  g->interior = _mm512_load_pd (lanes->interior + offset);
+  g->glitch = _mm512_load_pd (lanes->glitch + offset);
+}
+
+__attribute__ ((target ("avx512f"), always_inline)) static inline void
+render_group_store_avx512 (struct render_lanes *lanes, int offset,
+                           const struct render_group_avx512 *g)
+{
+  _mm512_store_pd (lanes->dz_re + offset, g->dz_re);
+  _mm512_store_pd (lanes->dz_im + offset, g->dz_im);
+  _mm512_store_pd (lanes->iter + offset, g->iter);
+  _mm512_store_pd (lanes->iter_orbit + offset, g->iter_orbit);
+  _mm512_store_pd (lanes->zn2 + offset, g->zn2);
+  _mm512_store_pd (lanes->saved_re + offset, g->saved_re);
+  _mm512_store_pd (lanes->saved_im + offset, g->saved_im);
+  _mm512_store_pd (lanes->saved_ref_re + offset, g->saved_ref_re);
+  _mm512_store_pd (lanes->saved_ref_im + offset, g->saved_ref_im);
+  _mm512_store_pd (lanes->saved_norm + offset, g->saved_norm);
+  _mm512_store_pd (lanes->der_re + offset, g->der_re);
+  _mm512_store_pd (lanes->der_im + offset, g->der_im);
+  _mm512_store_pd (lanes->interior + offset, g->interior);
+  _mm512_store_pd (lanes->glitch + offset, g->glitch);
+}
+
+// Same as render_group_step_avx2.
+__attribute__ ((target ("avx512f"), always_inline)) static inline void
+render_group_step_avx512 (const struct render_work *work,
+                          struct render_group_avx512 *g, int periodic,
+                          int save, int direct)
+{
+  const __m512d escape_radius_sq
+      = _mm512_set1_pd (ESCAPE_RADIUS * ESCAPE_RADIUS);
+  const __m512d orbit_escaped = _mm512_set1_pd (work->orbit_escaped);
+  const __m512d max_iter = _mm512_set1_pd (work->max_iter);
+  const __m512d zero = _mm512_setzero_pd ();
+  const __m512d one = _mm512_set1_pd (1.0);
+  const __m512d two = _mm512_set1_pd (2.0);
+
+  if (periodic)
+    {
+      __m512d der_re = _mm512_sub_pd (_mm512_mul_pd (g->z_re, g->der_re),
+                                      _mm512_mul_pd (g->z_im, g->der_im));
+      __m512d der_im = _mm512_add_pd (_mm512_mul_pd (g->z_re, g->der_im),
+                                      _mm512_mul_pd (g->z_im, g->der_re));
+
+      g->der_re = _mm512_mul_pd (two, der_re);
+      g->der_im = _mm512_mul_pd (two, der_im);
+    }
+
+  __m512d dz2_re = _mm512_sub_pd (_mm512_mul_pd (g->dz_re, g->dz_re),
+                                  _mm512_mul_pd (g->dz_im, g->dz_im));
+  __m512d dz2_im = _mm512_mul_pd (_mm512_mul_pd (two, g->dz_re), g->dz_im);
+
+  __m512d next_re = dz2_re;
+  __m512d next_im = dz2_im;
+
+  if (!direct)
+    {
+      __m512d temp_re = _mm512_sub_pd (_mm512_mul_pd (g->ref_re, g->dz_re),
+                                       _mm512_mul_pd (g->ref_im, g->dz_im));
+      __m512d temp_im = _mm512_add_pd (_mm512_mul_pd (g->ref_re, g->dz_im),
+                                       _mm512_mul_pd (g->ref_im, g->dz_re));
+
+      temp_re = _mm512_mul_pd (two, temp_re);
+      temp_im = _mm512_mul_pd (two, temp_im);
+
+      next_re = _mm512_add_pd (temp_re, dz2_re);
+      next_im = _mm512_add_pd (temp_im, dz2_im);
+    }
+
+  g->dz_re = _mm512_mask_add_pd (g->dz_re, g->active, next_re, g->dc_re);
+  g->dz_im = _mm512_mask_add_pd (g->dz_im, g->active, next_im, g->dc_im);
+
+  __m512d z_re = g->dz_re;
+  __m512d z_im = g->dz_im;
+
+  if (!direct)
+    {
+      g->iter_orbit = _mm512_mask_add_pd (g->iter_orbit, g->active,
+                                          g->iter_orbit, one);
+
+      __m256i index = _mm512_cvttpd_epi32 (g->iter_orbit);
+      g->ref_re = _mm512_i32gather_pd (index, work->orbit_re, 8);
+      g->ref_im = _mm512_i32gather_pd (index, work->orbit_im, 8);
+
+      z_re = _mm512_add_pd (g->ref_re, g->dz_re);
+      z_im = _mm512_add_pd (g->ref_im, g->dz_im);
+    }
+
+  __m512d z_norm
+      = _mm512_add_pd (_mm512_mul_pd (z_re, z_re), _mm512_mul_pd (z_im, z_im));
+
+  __mmask8 escaped = _mm512_mask_cmp_pd_mask (g->active, z_norm,
+                                              escape_radius_sq, _CMP_GT_OQ);
+  __mmask8 alive = g->active & ~escaped;
+
+  g->zn2 = _mm512_mask_blend_pd (alive, g->zn2, z_norm);
+
+  if (!direct)
+    {
+      __m512d dz_norm = _mm512_add_pd (_mm512_mul_pd (g->dz_re, g->dz_re),
+                                       _mm512_mul_pd (g->dz_im, g->dz_im));
+
+      __mmask8 rebase
+          = _mm512_mask_cmp_pd_mask (alive, dz_norm, z_norm, _CMP_GT_OQ)
+            | _mm512_mask_cmp_pd_mask (alive, g->iter_orbit, orbit_escaped,
+                                       _CMP_EQ_OQ);
+
+      __mmask8 glitched = _mm512_mask_cmp_pd_mask (
+          rebase, z_norm,
+          _mm512_mul_pd (_mm512_set1_pd (work->glitch_tolerance), dz_norm),
+          _CMP_LT_OQ);
+
+      if (glitched)
+        {
+          g->glitch
+              = _mm512_mask_div_pd (g->glitch, glitched, z_norm, dz_norm);
+          g->active &= ~glitched;
+        }
+
+      // Rebased lanes restart at orbit[0], which is always zero.
+      g->dz_re = _mm512_mask_blend_pd (rebase, g->dz_re, z_re);
+      g->dz_im = _mm512_mask_blend_pd (rebase, g->dz_im, z_im);
+      g->iter_orbit = _mm512_mask_blend_pd (rebase, g->iter_orbit, zero);
+      g->ref_re = _mm512_mask_blend_pd (rebase, g->ref_re, zero);
+      g->ref_im = _mm512_mask_blend_pd (rebase, g->ref_im, zero);
+
+      g->rebases = _mm512_mask_add_pd (g->rebases, rebase, g->rebases, one);
+    }
+
+  __mmask8 stepped = g->active & ~escaped;
+
+  g->iter = _mm512_mask_add_pd (g->iter, stepped, g->iter, one);
+
+  g->active = _mm512_mask_cmp_pd_mask (stepped, g->iter, max_iter, _CMP_LT_OQ);
+
+  if (periodic)
+    {
+      const __m512d period_tolerance
+          = _mm512_set1_pd (work->period_tolerance);
+
+      // After the rebase, as in render_period_step.
+      __m512d diff_re = _mm512_sub_pd (g->dz_re, g->saved_re);
+      __m512d diff_im = _mm512_sub_pd (g->dz_im, g->saved_im);
+
+      if (!direct)
+        {
+          diff_re = _mm512_add_pd (_mm512_sub_pd (g->ref_re, g->saved_ref_re),
+                                   diff_re);
+          diff_im = _mm512_add_pd (_mm512_sub_pd (g->ref_im, g->saved_ref_im),
+                                   diff_im);
+        }
+
+      __m512d diff_norm = _mm512_add_pd (_mm512_mul_pd (diff_re, diff_re),
+                                         _mm512_mul_pd (diff_im, diff_im));
+      __m512d der_norm = _mm512_add_pd (_mm512_mul_pd (g->der_re, g->der_re),
+                                        _mm512_mul_pd (g->der_im, g->der_im));
+      __m512d contraction = _mm512_sub_pd (one, der_norm);
+      __m512d bound = _mm512_mul_pd (
+          _mm512_mul_pd (period_tolerance, g->saved_norm),
+          _mm512_mul_pd (contraction, contraction));
+
+      __mmask8 inside
+          = _mm512_mask_cmp_pd_mask (alive, contraction, zero, _CMP_GT_OQ)
+            & _mm512_cmp_pd_mask (
+                _mm512_mul_pd (_mm512_set1_pd (4.0), diff_norm), bound,
+                _CMP_LT_OQ);
+
+      g->interior = _mm512_mask_mov_pd (g->interior, inside, one);
+      g->active &= ~inside;
+
+      g->z_re = z_re;
+      g->z_im = z_im;
+
+      if (save)
+        g->saved_norm = _mm512_set1_pd (INFINITY);
+
+      __mmask8 lower = _mm512_cmp_pd_mask (z_norm, g->saved_norm, _CMP_LT_OQ);
+
+      g->saved_re = _mm512_mask_mov_pd (g->saved_re, lower, g->dz_re);
+      g->saved_im = _mm512_mask_mov_pd (g->saved_im, lower, g->dz_im);
+      g->saved_ref_re = _mm512_mask_mov_pd (g->saved_ref_re, lower, g->ref_re);
+      g->saved_ref_im = _mm512_mask_mov_pd (g->saved_ref_im, lower, g->ref_im);
+      g->saved_norm = _mm512_mask_mov_pd (g->saved_norm, lower, z_norm);
+      g->der_re = _mm512_mask_mov_pd (g->der_re, lower, one);
+      g->der_im = _mm512_mask_mov_pd (g->der_im, lower, zero);
+    }
+}
+
+// Same as render_perturb_avx2_run, on two groups of eight pixels.
+__attribute__ ((target ("avx512f"), always_inline)) static inline int
+render_perturb_avx512_run (const struct render_work *work,
+                           struct render_batch *batch, long long *rebases,
+                           int periodic, int direct)
+{
+  struct render_lanes lanes;
+  struct render_group_avx512 a, b;
+
+  render_lanes_init (&lanes, 16);
+
+  a.rebases = _mm512_setzero_pd ();
+  b.rebases = _mm512_setzero_pd ();
+
+  int live = render_lanes_refill (&lanes, batch, 0xFFFF, 16, work->max_iter);
+
+  while (live)
+    {
+      render_group_load_avx512 (work, &lanes, 0, &a, direct);
+      render_group_load_avx512 (work, &lanes, 8, &b, direct);
+
+      int done = 0;
+
+      while (!done)
+        {
+          int save = periodic && render_lanes_save (&lanes);
+
+          render_group_step_avx512 (work, &a, periodic, save, direct);
+          render_group_step_avx512 (work, &b, periodic, save, direct);
+
+          done = live & ~(a.active | b.active << 8);
+        }
+
+      render_group_store_avx512 (&lanes, 0, &a);
+      render_group_store_avx512 (&lanes, 8, &b);
+
+      if (work->generation != atomic_load (&g_generation))
+        return 0;
+
+      live = render_lanes_refill (&lanes, batch, done, 16, work->max_iter);
+    }
+
+  *rebases += _mm512_reduce_add_pd (_mm512_add_pd (a.rebases, b.rebases));
+
+  return 1;
+}
+
+__attribute__ ((target ("avx512f"))) static int
+render_perturb_avx512 (const struct render_work *work,
+                       struct render_batch *batch, long long *rebases)
+{
+  if (work->direct && work->period_tolerance > 0.0)
+    return render_perturb_avx512_run (work, batch, rebases, 1, 1);
+
+  if (work->direct)
+    return render_perturb_avx512_run (work, batch, rebases, 0, 1);
+
+  if (work->period_tolerance > 0.0)
+    return render_perturb_avx512_run (work, batch, rebases, 1, 0);
+
+  return render_perturb_avx512_run (work, batch, rebases, 0, 0);
+}
+
+// Picked from CPUID in render_init; NULL when neither kernel is supported.
+static int (*render_perturb_lanes) (const struct render_work *,
+                                    struct render_batch *, long long *);
+
+static void
+render_init_kernels (void)
+{
+  __builtin_cpu_init ();
+
+  if (__builtin_cpu_supports ("avx512f"))
+    render_perturb_lanes = render_perturb_avx512;
+  else if (__builtin_cpu_supports ("avx2"))
+    render_perturb_lanes = render_perturb_avx2;
+}
+
+// BLA pays off where the first approximation already covers the batch; there
+// the scalar kernel skips far more than the lanes could gain.
+static int
+render_batch_wants_bla (const struct render_work *work,
+                        const struct render_batch *batch)
+{
+  if (!work->bla)
+    return 0;
+
+  double dc_norm = 0.0;
+
+  for (int i = 0; i < batch->count; ++i)
+    dc_norm = fmax (dc_norm, batch->dc_re[i] * batch->dc_re[i]
+                                 + batch->dc_im[i] * batch->dc_im[i]);
+
+  return bla_table_lookup (work->bla, 1, dc_norm, 0, work->max_iter) != NULL;
+}
+
+// Sets pixel i of the batch up to be iterated from the start.
+static void
+render_batch_start (const struct render_work *work,
+                    struct render_batch *batch, int i)
+{
+  batch->todo[i] = 1;
+  batch->dz_re[i] = 0.0;
+  batch->dz_im[i] = 0.0;
+  batch->dz_exp[i] = work->scale.exp < FLOATEXP_SWITCH_EXP ? work->scale.exp
+                                                            : 0;
+  // The step from 0 to c is not counted.
+  batch->iter[i] = -1;
+  batch->iter_orbit[i] = 0;
+  batch->zn2[i] = 0.0;
+  batch->interior[i] = 0;
+  batch->glitch[i] = -1.0;
+  batch->secondary[i] = 0;
+}
+
+// Starts pixel i of the batch from scratch, from the state it stopped in at
+// an older max_iter, or marks it done.
+static void
+render_batch_load (const struct render_work *work, struct render_batch *batch,
+                   int i)
+{
+  size_t index = (size_t)batch->y[i] * g_width + batch->x[i];
+
+  batch->zn2[i] = 0.0;
+  batch->iter[i] = render_done_load (work->generation, index, &batch->zn2[i]);
+  batch->todo[i] = batch->iter[i] == -1;
+  batch->interior[i] = 0;
+  batch->glitch[i] = -1.0;
+  batch->secondary[i] = 0;
+
+  if (batch->todo[i])
+    render_batch_start (work, batch, i);
+  else if (batch->iter[i] < work->max_iter
+           && pixels_state[index].iter == batch->iter[i])
+    {
+      const struct render_pixel_state *state = &pixels_state[index];
+
+      batch->todo[i] = 1;
+      batch->dz_re[i] = state->dz_re;
+      batch->dz_im[i] = state->dz_im;
+      batch->dz_exp[i] = state->dz_exp;
+      batch->iter_orbit[i] = state->iter_orbit;
+    }
+  else if (batch->iter[i] < work->max_iter
+           && pixels_state[index].iter == RENDER_INTERIOR)
+    batch->iter[i] = work->max_iter;
+  else if (batch->iter[i] < work->max_iter
+           && pixels_state[index].iter == RENDER_RESTART)
+    render_batch_start (work, batch, i);
+}
+
+// Iteration limit the published orbit allows for the pending pixels of the
+// batch: max_iter once the orbit is complete, otherwise as far as its prefix
+// reaches, since iter_orbit never gets past iter + 1, short of its last
+// entry, which may turn out to be the last before the reference escaped.
+// Sets *escaped as the kernels take it, which for a complete orbit whose
+// reference stayed bounded is its last entry: a pixel that never rebased
+// reaches it one iteration short of max_iter.  Waits for more of the orbit
+// while no pending pixel could advance.  Returns 0 when the generation
+// changed meanwhile.
+static int
+render_orbit_limit (const struct render_work *work,
+                    const struct render_batch *batch, int *limit,
+                    int *escaped)
+{
+  int iter_min = work->max_iter;
+
+  for (int i = 0; i < batch->count; ++i)
+    if (batch->todo[i] && batch->iter[i] < iter_min)
+      iter_min = batch->iter[i];
+
+  int valid = atomic_load_explicit (&g_orbit_valid, memory_order_acquire);
+
+  if (iter_min < work->max_iter && valid < work->orbit_amount
+      && valid - 3 <= iter_min)
+    {
+      pthread_mutex_lock (&g_orbit_mutex);
+
+      while (work->generation == atomic_load (&g_generation))
+        {
+          valid = atomic_load_explicit (&g_orbit_valid, memory_order_acquire);
+
+          if (valid >= work->orbit_amount || valid - 3 > iter_min)
+            break;
+
+          pthread_cond_wait (&g_orbit_cond, &g_orbit_mutex);
+        }
+
+      pthread_mutex_unlock (&g_orbit_mutex);
+    }
+
+  if (work->generation != atomic_load (&g_generation))
+    return 0;
+
+  if (valid < work->orbit_amount)
+    *escaped = -1;
+  else if ((*escaped = atomic_load (&g_orbit_escaped)) < 0)
+    *escaped = work->orbit_amount - 1;
+
+  if (valid >= work->orbit_amount || valid - 3 >= work->max_iter)
+    *limit = work->max_iter;
+  else
+    *limit = valid - 3;
+
+  return 1;
+}
+
+// Runs the pending pixels of the batch up to work->max_iter, on the lanes
+// where they can take it.
+static int
+render_flush_lanes (const struct render_work *work,
+                    struct render_batch *batch, long long *rebases)
+{
+  if (render_perturb_lanes && work->scale.exp >= FLOATEXP_SWITCH_EXP
+      && !render_batch_wants_bla (work, batch))
+    return render_perturb_lanes (work, batch, rebases);
+
+  for (int i = 0; i < batch->count; ++i)
+    {
+      if (!batch->todo[i])
+        continue;
+
+      if (work->generation != atomic_load (&g_generation))
+        return 0;
+
+      struct floatexp_complex delta_c;
+
+      delta_c.re = batch->dc_x[i] * work->scale.mant;
+      delta_c.im = batch->dc_y[i] * work->scale.mant;
+      delta_c.exp = work->scale.exp;
+
+      struct render_state state;
+
+      state.dz_re = batch->dz_re[i];
+      state.dz_im = batch->dz_im[i];
+      state.dz_exp = batch->dz_exp[i];
+      state.iter = batch->iter[i];
+      state.iter_orbit = batch->iter_orbit[i];
+      state.zn2 = batch->zn2[i];
+      state.interior = 0;
+      state.glitch = -1.0;
+      render_period_init (&state.period);
+
+      if (state.dz_exp == 0
+          || render_perturb_floatexp (work, delta_c, &state, rebases))
+        render_perturb (work, batch->dc_re[i], batch->dc_im[i], &state,
+                        rebases);
+
+      batch->dz_re[i] = state.dz_re;
+      batch->dz_im[i] = state.dz_im;
+      batch->dz_exp[i] = state.dz_exp;
+      batch->iter[i] = state.iter;
+      batch->iter_orbit[i] = state.iter_orbit;
+      batch->zn2[i] = state.zn2;
+      batch->interior[i] = state.interior;
+      batch->glitch[i] = state.glitch;
+    }
+
+  return 1;
+}
+
+// Runs the pending pixels of the batch up to work->max_iter.  Most pixels
+// escape early, cycles are only looked for in the ones still going after
+// RENDER_PERIOD_START iterations, or a fraction of max_iter where no interior
+// was found so far.
+static int
+render_flush_run (const struct render_work *work, struct render_batch *batch,
+                  long long *rebases)
+{
+  int period_start = RENDER_PERIOD_START;
+
+  if (!g_interior_last
+      && !atomic_load_explicit (&g_interior, memory_order_relaxed)
+      && work->max_iter / RENDER_PERIOD_FRACTION > period_start)
+    period_start = work->max_iter / RENDER_PERIOD_FRACTION;
+
+  if (work->period_tolerance > 0.0 && work->max_iter > period_start)
+    {
+      struct render_work start = *work;
+
+      start.max_iter = period_start;
+      start.period_tolerance = 0.0;
+
+      if (!render_flush_lanes (&start, batch, rebases))
+        return 0;
+
+      for (int i = 0; i < batch->count; ++i)
+        if (batch->iter[i] < period_start)
+          batch->todo[i] = 0;
+    }
+
+  return render_flush_lanes (work, batch, rebases);
+}
+
+// Secondary references tried per batch before its pixels still glitched are
+// rebased through after all.
+#define RENDER_GLITCH_ATTEMPTS 4
+
+// Computes the orbit of the secondary reference, the way the reference's own
+// is, with as many bits.
+static void
+render_secondary_compute (struct render_secondary *secondary, int generation)
+{
+  mpfr_t center_re, center_im, z_re, z_im;
+  mpfr_inits2 (mpfr_get_prec (g_orbit_center_re), center_re, center_im,
+               z_re, z_im, (mpfr_ptr)0);
+
+  mpfr_set_d (center_re, secondary->dc.re, MPFR_RNDN);
+  mpfr_mul_2si (center_re, center_re, secondary->dc.exp, MPFR_RNDN);
+  mpfr_add (center_re, center_re, g_orbit_center_re, MPFR_RNDN);
+
+  mpfr_set_d (center_im, secondary->dc.im, MPFR_RNDN);
+  mpfr_mul_2si (center_im, center_im, secondary->dc.exp, MPFR_RNDN);
+  mpfr_add (center_im, center_im, g_orbit_center_im, MPFR_RNDN);
+
+  mpfr_set_d (z_re, 0.0, MPFR_RNDN);
+  mpfr_set_d (z_im, 0.0, MPFR_RNDN);
+
+  int amount = secondary->max_iter + 1;
+  int computed = render_orbit_iterate (center_re, center_im, z_re, z_im,
+                                       secondary->orbit_re,
+                                       secondary->orbit_im, 0, amount,
+                                       generation, 0);
+
+  for (int i = computed; i < amount; ++i)
+    secondary->orbit_re[i] = secondary->orbit_im[i] = 0.0;
+
+  // Pixels rebase past its last entry, whether the reference escaped or not.
+  secondary->orbit_escaped = computed - 1;
+
+  mpfr_clears (center_re, center_im, z_re, z_im, (mpfr_ptr)0);
+}
+
+// Where the secondary reference lies from the reference, in units of
+// work->scale.
+static void
+render_secondary_offset (const struct render_work *work,
+                         const struct render_secondary *secondary,
+                         double *dc_x, double *dc_y)
+{
+  *dc_x = ldexp (secondary->dc.re / work->scale.mant,
+                 secondary->dc.exp - work->scale.exp);
+  *dc_y = ldexp (secondary->dc.im / work->scale.mant,
+                 secondary->dc.exp - work->scale.exp);
+}
+
+// The secondary reference for the glitched pixel i of the batch but the
+// tried ones.  Glitches of one iteration are copies of each other all over,
+// so the nearest one placed in a glitch at the same iteration comes first.
+// Else, on the first attempt, the nearest ready one placed at another
+// iteration, since any reference close by serves where the pixels do not
+// glitch against it too, and that costs far less than a new orbit.  Else a
+// new one at the pixel, or once the table is full, the nearest ready one
+// after all.  Returns NULL when none is left or the generation moved on.
+static struct render_secondary *
+render_secondary_take (const struct render_work *work,
+                       const struct render_batch *batch, int i,
+                       struct render_secondary *const *tried,
+                       int tried_amount)
+{
+  struct render_secondary *secondary = NULL;
+  struct render_secondary *other = NULL;
+  double distance = INFINITY;
+  double other_distance = INFINITY;
+
+  pthread_mutex_lock (&g_secondary_mutex);
+
+  for (int j = 0; j < g_secondaries_amount; ++j)
+    {
+      struct render_secondary *candidate = &g_secondaries[j];
+
+      int seen = 0;
+
+      for (int k = 0; k < tried_amount; ++k)
+        seen |= tried[k] == candidate;
+
+      if (seen || candidate->max_iter != work->max_iter)
+        continue;
+
+      double dc_x, dc_y;
+      render_secondary_offset (work, candidate, &dc_x, &dc_y);
+
+      double candidate_distance
+          = hypot (dc_x - batch->dc_x[i], dc_y - batch->dc_y[i]);
+
+      if (candidate->glitch_iter == batch->iter[i])
+        {
+          if (candidate_distance < distance)
+            {
+              secondary = candidate;
+              distance = candidate_distance;
+            }
+        }
+      else if (candidate->ready && candidate_distance < other_distance)
+        {
+          other = candidate;
+          other_distance = candidate_distance;
+        }
+    }
+
+  if (!secondary && other
+      && (tried_amount == 0 || g_secondaries_amount == RENDER_SECONDARY_MAX))
+    secondary = other;
+
+  if (secondary)
+    {
+      // Computed by another worker meanwhile.
+      while (!secondary->ready
+             && work->generation == atomic_load (&g_generation))
+        pthread_cond_wait (&g_secondary_cond, &g_secondary_mutex);
+
+      pthread_mutex_unlock (&g_secondary_mutex);
+    }
+  else if (g_secondaries_amount < RENDER_SECONDARY_MAX)
+    {
+      secondary = &g_secondaries[g_secondaries_amount];
+
+      // Grown before the entry is published, no one else touches it then.
+      if (secondary->orbit_capacity < work->max_iter + 1)
+        {
+          secondary->orbit_capacity = work->max_iter + 1;
+          secondary->orbit_re = realloc (secondary->orbit_re,
+                                         secondary->orbit_capacity
+                                             * sizeof (double));
+          secondary->orbit_im = realloc (secondary->orbit_im,
+                                         secondary->orbit_capacity
+                                             * sizeof (double));
+        }
+
+      secondary->dc.re = batch->dc_x[i] * work->scale.mant;
+      secondary->dc.im = batch->dc_y[i] * work->scale.mant;
+      secondary->dc.exp = work->scale.exp;
+      secondary->glitch_iter = batch->iter[i];
+      secondary->max_iter = work->max_iter;
+      secondary->ready = 0;
+
+      g_secondaries_amount++;
+
+      pthread_mutex_unlock (&g_secondary_mutex);
+
+      render_secondary_compute (secondary, work->generation);
+
+      pthread_mutex_lock (&g_secondary_mutex);
+      secondary->ready = 1;
+      pthread_cond_broadcast (&g_secondary_cond);
+      pthread_mutex_unlock (&g_secondary_mutex);
+    }
+  else
+    pthread_mutex_unlock (&g_secondary_mutex);
+
+  if (work->generation != atomic_load (&g_generation))
+    return NULL;
+
+  return secondary;
+}
+
+// Takes the glitched pixels of the batch again, those glitched at one
+// iteration at a time, against a secondary reference at the one of them
+// that came closest to zero, the middle of their glitch.  What still
+// glitches after RENDER_GLITCH_ATTEMPTS references is rebased through
+// against the reference after all.  Returns 0 once the generation moved on.
+static int
+render_batch_deglitch (const struct render_work *work,
+                       struct render_batch *batch, long long *rebases)
+{
+  struct render_secondary *tried[RENDER_GLITCH_ATTEMPTS];
+  int attempts = 0;
+
+  while (attempts < RENDER_GLITCH_ATTEMPTS)
+    {
+      int best = -1;
+
+      for (int i = 0; i < batch->count; ++i)
+        if (batch->glitch[i] >= 0.0
+            && (best < 0 || batch->glitch[i] < batch->glitch[best]))
+          best = i;
+
+      if (best < 0)
+        return 1;
+
+      struct render_secondary *secondary
+          = render_secondary_take (work, batch, best, tried, attempts);
+
+      if (work->generation != atomic_load (&g_generation))
+        return 0;
+
+      if (!secondary)
+        break;
+
+      tried[attempts++] = secondary;
+
+      struct render_work against = *work;
+
+      against.orbit_re = secondary->orbit_re;
+      against.orbit_im = secondary->orbit_im;
+      against.orbit_amount = secondary->max_iter + 1;
+      against.orbit_escaped = secondary->orbit_escaped;
+      against.bla = NULL;
+
+      double secondary_x, secondary_y;
+      render_secondary_offset (work, secondary, &secondary_x, &secondary_y);
+
+      int glitch_iter = batch->iter[best];
+      int group[RENDER_BATCH];
+      double dc_x[RENDER_BATCH];
+      double dc_y[RENDER_BATCH];
+
+      for (int i = 0; i < batch->count; ++i)
+        {
+          group[i] = batch->glitch[i] >= 0.0 && batch->iter[i] == glitch_iter;
+          batch->todo[i] = 0;
+
+          if (!group[i])
+            continue;
+
+          dc_x[i] = batch->dc_x[i];
+          dc_y[i] = batch->dc_y[i];
+
+          batch->dc_x[i] -= secondary_x;
+          batch->dc_y[i] -= secondary_y;
+          batch->dc_re[i] = ldexp (batch->dc_x[i] * work->scale.mant,
+                                   work->scale.exp);
+          batch->dc_im[i] = ldexp (batch->dc_y[i] * work->scale.mant,
+                                   work->scale.exp);
+
+          render_batch_start (work, batch, i);
+          batch->secondary[i] = 1;
+        }
+
+      int running = render_flush_run (&against, batch, rebases);
+
+      for (int i = 0; i < batch->count; ++i)
+        if (group[i])
+          {
+            batch->dc_x[i] = dc_x[i];
+            batch->dc_y[i] = dc_y[i];
+            batch->dc_re[i] = ldexp (dc_x[i] * work->scale.mant,
+                                     work->scale.exp);
+            batch->dc_im[i] = ldexp (dc_y[i] * work->scale.mant,
+                                     work->scale.exp);
+          }
+
+      if (!running)
+        return 0;
+    }
+
+  struct render_work through = *work;
+
+  through.glitch_tolerance = 0.0;
+
+  int left = 0;
+
+  for (int i = 0; i < batch->count; ++i)
+    {
+      batch->todo[i] = 0;
+
+      if (batch->glitch[i] >= 0.0)
+        {
+          render_batch_start (work, batch, i);
+          left = 1;
+        }
+    }
+
+  return !left || render_flush_run (&through, batch, rebases);
+}
+
+// Marks the square of size pixels at x, y as changed, after painting it.
+static void
+render_mark_dirty (int x, int y, int size)
+{
+  int column_end = (x + size - 1) / RENDER_DIRTY_CELL;
+  int row_end = (y + size - 1) / RENDER_DIRTY_CELL;
+
+  if (column_end >= g_dirty_columns)
+    column_end = g_dirty_columns - 1;
+
+  if (row_end >= g_dirty_rows)
+    row_end = g_dirty_rows - 1;
+
+  for (int row = y / RENDER_DIRTY_CELL; row <= row_end; ++row)
+    for (int column = x / RENDER_DIRTY_CELL; column <= column_end; ++column)
+      atomic_store_explicit (&g_dirty[row * g_dirty_columns + column], 1,
+                             memory_order_release);
+}
+
+// Iterates the pixels of the batch with todo set up to work->max_iter, in
+// chunks as far as the orbit goes while it is still coming in, then takes
+// the glitched ones again.  Returns 0 once the generation moved on.
+static int
+render_batch_iterate (const struct render_work *work,
+                      struct render_batch *batch, long long *rebases)
+{
+  while (1)
+    {
+      struct render_work chunk = *work;
+
+      if (!render_orbit_limit (work, batch, &chunk.max_iter,
+                               &chunk.orbit_escaped))
+        return 0;
+
+      chunk.bla = atomic_load (&g_bla_ready) ? &g_bla : NULL;
+
+      if (!render_flush_run (&chunk, batch, rebases))
+        return 0;
+
+      if (chunk.max_iter == work->max_iter)
+        return render_batch_deglitch (&chunk, batch, rebases);
+
+      // Short of the limit means escaped; the others are still pending.
+      for (int i = 0; i < batch->count; ++i)
+        if (batch->iter[i] < chunk.max_iter)
+          batch->todo[i] = 0;
+    }
+}
+
+static int
+render_flush (const struct render_work *work, struct render_batch *batch,
+              long long *iterations, long long *rebases)
+{
+  int iter_start[RENDER_BATCH];
+  int computed[RENDER_BATCH];
+
+  for (int i = 0; i < batch->count; ++i)
+    {
+      iter_start[i] = batch->iter[i];
+      computed[i] = batch->todo[i];
+    }
+
+  if (!render_batch_iterate (work, batch, rebases))
+    return 0;
+
+  for (int i = 0; i < batch->count; ++i)
+    {
+      // Computed by an earlier pass, which already painted it.
+      if (!computed[i])
+        continue;
+
+      *iterations += batch->iter[i] - iter_start[i];
+
+      int x = batch->x[i];
+      int y = batch->y[i];
+
+      // One more for the work around the iterations.
+      atomic_fetch_add_explicit (
+          &g_cost[(y / RENDER_COST_CELL) * g_cost_columns
+                  + x / RENDER_COST_CELL],
+          batch->iter[i] - iter_start[i] + 1, memory_order_relaxed);
+
+      struct render_pixel_state limit;
+
+      limit.dz_re = batch->dz_re[i];
+      limit.dz_im = batch->dz_im[i];
+      limit.dz_exp = batch->dz_exp[i];
+      limit.iter = batch->iter[i];
+      limit.iter_orbit = batch->iter_orbit[i];
+
+      // Inside for good, whatever max_iter comes.
+      if (batch->interior[i])
+        {
+          limit.iter = RENDER_INTERIOR;
+          batch->iter[i] = work->max_iter;
+
+          atomic_store_explicit (&g_interior, 1, memory_order_relaxed);
+        }
+      else if (batch->secondary[i])
+        limit.iter = RENDER_RESTART;
+
+      render_done_store (work->generation, (size_t)y * g_width + x,
+                         batch->iter[i], batch->zn2[i],
+                         batch->iter[i] == work->max_iter ? &limit : NULL);
+    }
+
+  // The blocks of a coarse pass race with the finer passes storing the
+  // pixels under them.  Each pixel of a block is checked again after the
+  // fence of its painting, one stored meanwhile gets its own values back.
+  // Either that check sees it stored, or its own values are written after
+  // the block.
+  atomic_thread_fence (memory_order_seq_cst);
+
+  int version = atomic_load (&g_coloring_version);
+
+  struct render_coloring coloring;
+  render_coloring_load (&coloring);
+
+  for (int i = 0; i < batch->count; ++i)
+    {
+      // Computed by an earlier pass, which already painted it.
+      if (!computed[i])
+        continue;
+
+      int x = batch->x[i];
+      int y = batch->y[i];
+
+      int iter = batch->iter[i] == work->max_iter ? -1 : batch->iter[i];
+      float smooth = iter == -1 ? 0.0f : render_smooth (batch->zn2[i]);
+
+      for (int step_y = 0; step_y < work->step && y + step_y < g_height;
+           ++step_y)
+        for (int step_x = 0; step_x < work->step && x + step_x < g_width;
+             ++step_x)
+          {
+            size_t index = (size_t)(y + step_y) * g_width + (x + step_x);
+            int block = step_x || step_y;
+
+            if (block && render_done_final (work->generation, index))
+              continue;
+
+            atomic_store_explicit (&pixels_iter[index], iter,
+                                   memory_order_relaxed);
+            atomic_store_explicit (&pixels_smooth[index], smooth,
+                                   memory_order_relaxed);
+
+            render_paint (&coloring, &version, index);
+
+            if (block && render_done_final (work->generation, index))
+              {
+                render_done_restore (work->generation, index);
+                render_paint (&coloring, &version, index);
+              }
+          }
+    }
+
+  render_mark_dirty (work->x, work->y, work->tile);
+
+  batch->count = 0;
+
+  return 1;
+}
+
+// Pixels whose iterations, smoothed, differ from a neighbour's by more than
+// this, or that escaped next to one that did not, lie on an edge.
+#define RENDER_SAMPLES_EDGE 1.0
+
+// Where the point at pixel x, y lies from the reference, in units of
+// work->scale.  Under the exponential map, work->scale is the pixel spacing
+// at row work->y.
+static void
+render_pixel_delta (const struct render_work *work, double x, double y,
+                    double *dc_x, double *dc_y)
+{
+  if (g_map == RENDER_MAP_EXP)
+    {
+      double radius = render_map_radius (y - work->y);
+      double angle = 2 * M_PI * x / g_width;
+
+      *dc_x = radius * cos (angle) + work->offset_re;
+      *dc_y = radius * sin (angle) + work->offset_im;
+      return;
+    }
+
+  *dc_x = x - g_width / 2.0 + work->offset_re;
+  *dc_y = y - g_height / 2.0 + work->offset_im;
+}
+
+// Offset of extra sample s within its pixel, from the R2 sequence, which
+// spreads any amount of samples evenly around the center, sample 0.
+static void
+render_jitter (int s, double *jitter_x, double *jitter_y)
+{
+  *jitter_x = 0.5 + s * 0.7548776662466927;
+  *jitter_y = 0.5 + s * 0.5698402909980532;
+
+  *jitter_x -= floor (*jitter_x) + 0.5;
+  *jitter_y -= floor (*jitter_y) + 0.5;
+}
+
+static int
+render_wants_samples (int x, int y)
+{
+  size_t index = (size_t)y * g_width + x;
+
+  int iter = atomic_load_explicit (&pixels_iter[index], memory_order_relaxed);
+
+  if (iter == -2)
+    return 0;
+
+  double nu = iter
+              + atomic_load_explicit (&pixels_smooth[index],
+                                      memory_order_relaxed);
+
+  for (int neighbour_y = y - 1; neighbour_y <= y + 1; ++neighbour_y)
+    for (int neighbour_x = x - 1; neighbour_x <= x + 1; ++neighbour_x)
+      {
+        if (neighbour_x < 0 || neighbour_x >= g_width || neighbour_y < 0
+            || neighbour_y >= g_height)
+          continue;
+
+        size_t neighbour = (size_t)neighbour_y * g_width + neighbour_x;
+
+        int neighbour_iter = atomic_load_explicit (&pixels_iter[neighbour],
+                                                   memory_order_relaxed);
+
+        if (neighbour_iter == -2)
+          continue;
+
+        if ((iter == -1) != (neighbour_iter == -1))
+          return 1;
+
+        if (iter != -1
+            && fabs (neighbour_iter
+                     + atomic_load_explicit (&pixels_smooth[neighbour],
+                                             memory_order_relaxed)
+                     - nu)
+                   > RENDER_SAMPLES_EDGE)
+          return 1;
+      }
+
+  return 0;
+}
+
+// Stores the samples of the batch, and colors the pixels whose last sample
+// is among them.
+static int
+render_flush_samples (const struct render_work *work,
+                      struct render_batch *batch, long long *iterations,
+                      long long *rebases)
+{
+  if (!render_batch_iterate (work, batch, rebases))
+    return 0;
+
+  for (int i = 0; i < batch->count; ++i)
+    {
+      // Counted from -1, as they all started from 0.
+      *iterations += batch->iter[i] + 1;
+
+      size_t index = (size_t)batch->y[i] * g_width + batch->x[i];
+
+      struct render_sample *sample
+          = &g_samples[index * (RENDER_SAMPLES_MAX - 1) + batch->sample[i]
+                       - 1];
+
+      if (batch->interior[i] || batch->iter[i] == work->max_iter)
+        {
+          sample->iter = -1;
+          sample->smooth = 0.0f;
+        }
+      else
+        {
+          sample->iter = batch->iter[i];
+          sample->smooth = render_smooth (batch->zn2[i]);
+        }
+
+      if (batch->sample[i] == work->samples - 1)
+        atomic_store_explicit (&g_samples_amount[index], work->samples - 1,
+                               memory_order_release);
+    }
+
+  int version = atomic_load (&g_coloring_version);
+
+  struct render_coloring coloring;
+  render_coloring_load (&coloring);
+
+  // Recolorings may paint the pixels meanwhile, see render_paint.
+  for (int i = 0; i < batch->count; ++i)
+    if (batch->sample[i] == work->samples - 1)
+      render_paint (&coloring, &version,
+                    (size_t)batch->y[i] * g_width + batch->x[i]);
+
+  batch->count = 0;
+
+  return 1;
+}
+
+// Takes work->samples samples of the pixels of the tile on an edge, the
+// pixel center and ones jittered around it.  The pixels must all be
+// painted already.
+static void
+render_supersample (const struct render_work *work)
+{
+  long long iterations = 0;
+  long long rebases = 0;
+
+  struct render_batch batch;
+
+  batch.count = 0;
+
+  for (int y = work->y; y < work->y + work->tile && y < g_height; ++y)
+    for (int x = work->x; x < work->x + work->tile && x < g_width; ++x)
+      {
+        size_t index = (size_t)y * g_width + x;
+
+        if (atomic_load_explicit (&g_samples_amount[index],
+                                  memory_order_relaxed)
+            || !render_wants_samples (x, y))
+          continue;
+
+        for (int s = 1; s < work->samples; ++s)
+          {
+            int i = batch.count++;
+
+            batch.x[i] = x;
+            batch.y[i] = y;
+            batch.sample[i] = s;
+
+            double jitter_x, jitter_y;
+            render_jitter (s, &jitter_x, &jitter_y);
+
+            render_pixel_delta (work, x + jitter_x, y + jitter_y,
+                                &batch.dc_x[i], &batch.dc_y[i]);
+
+            batch.dc_re[i] = ldexp (batch.dc_x[i] * work->scale.mant,
+                                    work->scale.exp);
+            batch.dc_im[i] = ldexp (batch.dc_y[i] * work->scale.mant,
+                                    work->scale.exp);
+            render_batch_start (work, &batch, i);
+
+            if (batch.count == RENDER_BATCH
+                && !render_flush_samples (work, &batch, &iterations,
+                                          &rebases))
+              goto clean;
+          }
+      }
+
+  if (batch.count > 0 && !render_flush_samples (work, &batch, &iterations,
+                                                &rebases))
+    goto clean;
+
+  render_mark_dirty (work->x, work->y, work->tile);
+
+clean:
+  atomic_fetch_add (&g_stat_iterations, iterations);
+  atomic_fetch_add (&g_stat_rebases, rebases);
+}
+
+void
+render_test (void *argument)
+{
+  struct render_work *work = argument;
+
+  if (work->samples > 1)
+    {
+      render_supersample (work);
+      return;
+    }
+
+  long long iterations = 0;
+  long long rebases = 0;
+
+  struct render_batch batch;
+
+  batch.count = 0;
+
+  for (int delta_y = 0; delta_y < work->tile; delta_y += work->step)
+    {
+      int y = work->y + delta_y;
+
+      if (y >= g_height)
+        break;
+
+      for (int delta_x = 0; delta_x < work->tile; delta_x += work->step)
+        {
+          int x = work->x + delta_x;
+
+          if (x >= g_width)
+            break;
+
+          int i = batch.count++;
+
+          batch.x[i] = x;
+          batch.y[i] = y;
+
+          render_pixel_delta (work, x, y, &batch.dc_x[i], &batch.dc_y[i]);
+
+          batch.dc_re[i] = ldexp (batch.dc_x[i] * work->scale.mant,
+                                  work->scale.exp);
+          batch.dc_im[i] = ldexp (batch.dc_y[i] * work->scale.mant,
+                                  work->scale.exp);
+          render_batch_load (work, &batch, i);
+
+          if (batch.count == RENDER_BATCH
+              && !render_flush (work, &batch, &iterations, &rebases))
+            goto clean;
+        }
+    }
+
+  if (batch.count > 0)
+    render_flush (work, &batch, &iterations, &rebases);
+
+clean:
+  atomic_fetch_add (&g_stat_iterations, iterations);
+  atomic_fetch_add (&g_stat_rebases, rebases);
+}
+
+static struct render_arena_block *
+render_arena_block_new (size_t size)
+{
+  size_t capacity = size > RENDER_ARENA_BLOCK_SIZE ? size
+                                                   : RENDER_ARENA_BLOCK_SIZE;
+  struct render_arena_block *block;
+
+  block = malloc (sizeof (struct render_arena_block) + capacity);
+
+  block->next = NULL;
+  block->used = 0;
+  block->capacity = capacity;
+
+  return block;
+}
+
+// Zeroed room for size bytes until the generation moves on.
+static void *
+render_arena_alloc (size_t size)
+{
+  int generation = atomic_load (&g_generation);
+
+  if (!g_arena_first)
+    {
+      g_arena_first = render_arena_block_new (size);
+      g_arena_current = g_arena_first;
+      g_arena_generation = generation;
+    }
+
+  if (generation != g_arena_generation)
+    {
+      for (struct render_arena_block *block = g_arena_first; block;
+           block = block->next)
+        block->used = 0;
+
+      g_arena_current = g_arena_first;
+      g_arena_generation = generation;
+    }
+
+  size = (size + 15) & ~(size_t)15;
+
+  while (g_arena_current->used + size > g_arena_current->capacity)
+    {
+      if (!g_arena_current->next)
+        g_arena_current->next = render_arena_block_new (size);
+
+      g_arena_current = g_arena_current->next;
+    }
+
+  void *data = g_arena_current->data + g_arena_current->used;
+  g_arena_current->used += size;
+
+  memset (data, 0, size);
+  return data;
+}
+
+static struct floatexp
+render_scale (mpfr_t scale)
+{
+  long exp;
+  double mant = mpfr_get_d_2exp (&exp, scale, MPFR_RNDN);
+
+  return floatexp_make (mant, exp);
+}
+
+// Bits needed to resolve a pixel spacing of scale, with PRECISION_MARGIN
+// bits to spare.
+int
+render_precision (mpfr_t scale)
+{
+  long bits = PRECISION_MARGIN - mpfr_get_exp (scale);
+
+  if (bits < PRECISION_MIN)
+    bits = PRECISION_MIN;
+
+  return bits;
+}
+
+// Offset of the view center from the reference, in pixels.
+static void
+render_offset (mpfr_t center_re, mpfr_t center_im, mpfr_t scale,
+               double *offset_re, double *offset_im)
+{
+  mpfr_t temp;
+  mpfr_init2 (temp, mpfr_get_prec (g_orbit_center_re));
+
+  mpfr_sub (temp, center_re, g_orbit_center_re, MPFR_RNDN);
+  mpfr_div (temp, temp, scale, MPFR_RNDN);
+  *offset_re = mpfr_get_d (temp, MPFR_RNDN);
+
+  mpfr_sub (temp, center_im, g_orbit_center_im, MPFR_RNDN);
+  mpfr_div (temp, temp, scale, MPFR_RNDN);
+  *offset_im = mpfr_get_d (temp, MPFR_RNDN);
+
+  mpfr_clear (temp);
+}
+
+// The current orbit serves a new view as long as it is as long as max_iter,
+// was computed with enough bits for the new scale, and its reference still
+// lies inside the view.  Pixels outliving an escaped one are rebased as in
+// any other view.  The orbit of 0 serves all views shallow enough, and only
+// those.
+static int
+render_orbit_reusable (mpfr_t center_re, mpfr_t center_im, mpfr_t scale,
+                       int max_iter, double *offset_re, double *offset_im)
+{
+  int direct = render_scale (scale).exp >= RENDER_DIRECT_EXP;
+
+  if (atomic_load (&g_orbit_amount) != max_iter + 1
+      || atomic_load (&g_orbit_valid) != max_iter + 1
+      || direct != g_orbit_direct
+      || (!direct
+          && mpfr_get_prec (g_orbit_center_re) < render_precision (scale)))
+    return 0;
+
+  render_offset (center_re, center_im, scale, offset_re, offset_im);
+
+  return direct || render_view_contains (*offset_re, *offset_im);
+}
+
+// Pixels kept by render_reproject that stopped at max_iter hold their delta
+// to the orbit they were computed against.  Against a new one they start
+// over.
+static void
+render_drop_resumable (void)
+{
+  for (size_t i = 0; i < (size_t)g_width * g_height; ++i)
+    {
+      int64_t done = atomic_load_explicit (&pixels_done[i],
+                                           memory_order_relaxed);
+
+      if (done != -1 && (int)(done >> 32) == g_frame_generation
+          && pixels_state[i].iter == (int)done)
+        atomic_store_explicit (&pixels_done[i], -1, memory_order_relaxed);
+    }
+}
+
+// Prepares the orbit for a view, reusing the current one when it still
+// fits.  Passes of the same generation can be enqueued right after, they
+// follow the orbit as it is published.  Nothing may be rendering meanwhile,
+// and g_orbit_re/g_orbit_im must have room for max_iter + 1 entries.
+void
+render_enqueue_orbit (struct thread_pool *pool,
+                      struct thread_pool_group *group, mpfr_t center_re,
+                      mpfr_t center_im, mpfr_t scale, int max_iter)
+{
+  struct orbit_work *work;
+
+  work = render_arena_alloc (sizeof (struct orbit_work));
+
+  work->scale = render_scale (scale);
+  work->max_iter = max_iter;
+  work->generation = atomic_load (&g_generation);
+
+  atomic_store (&g_bla_ready, 0);
+
+  if (render_orbit_reusable (center_re, center_im, scale, max_iter,
+                             &work->offset_re, &work->offset_im))
+    {
+      thread_pool_enqueue (pool, group, render_reuse_orbit_thread, NULL,
+                           work);
+      return;
+    }
+
+  work->offset_re = 0.0;
+  work->offset_im = 0.0;
+
+  int precision = render_precision (scale);
+  int direct = work->scale.exp >= RENDER_DIRECT_EXP;
+
+  // The reference is kept at full precision, deeper views can reuse it.
+  if (!direct && g_reference_set
+      && mpfr_get_prec (g_reference_re) >= precision)
+    {
+      mpfr_set_prec (g_orbit_center_re, mpfr_get_prec (g_reference_re));
+      mpfr_set_prec (g_orbit_center_im, mpfr_get_prec (g_reference_im));
+      mpfr_set (g_orbit_center_re, g_reference_re, MPFR_RNDN);
+      mpfr_set (g_orbit_center_im, g_reference_im, MPFR_RNDN);
+
+      render_offset (center_re, center_im, scale, &work->offset_re,
+                     &work->offset_im);
+    }
+
+  if (direct)
+    {
+      mpfr_set_prec (g_orbit_center_re, PRECISION_MIN);
+      mpfr_set_prec (g_orbit_center_im, PRECISION_MIN);
+      mpfr_set_d (g_orbit_center_re, 0.0, MPFR_RNDN);
+      mpfr_set_d (g_orbit_center_im, 0.0, MPFR_RNDN);
+
+      render_offset (center_re, center_im, scale, &work->offset_re,
+                     &work->offset_im);
+    }
+  else if (!g_reference_set || mpfr_get_prec (g_reference_re) < precision
+           || !render_view_contains (work->offset_re, work->offset_im))
+    {
+      work->offset_re = 0.0;
+      work->offset_im = 0.0;
+
+      mpfr_set_prec (g_orbit_center_re, precision);
+      mpfr_set_prec (g_orbit_center_im, precision);
+      mpfr_set (g_orbit_center_re, center_re, MPFR_RNDN);
+      mpfr_set (g_orbit_center_im, center_im, MPFR_RNDN);
+    }
+
+  render_drop_resumable ();
+
+  g_secondaries_amount = 0;
+  g_orbit_direct = direct;
+  g_orbit_computed = 0;
+  atomic_store (&g_orbit_escaped, -1);
+  atomic_store (&g_orbit_valid, 0);
+  atomic_store (&g_orbit_amount, max_iter + 1);
+
+  thread_pool_enqueue (pool, group,
+                       direct ? render_direct_orbit_thread
+                              : render_compute_orbit_thread,
+                       NULL, work);
+}
+
+// Makes re + i im the reference of the orbits computed from now on, for
+// the views it lies in with no fewer bits than they need; the others keep
+// using their center, or 0 when shallow enough.  The current orbit is
+// dropped, so nothing may be rendering meanwhile.
+void
+render_set_reference (mpfr_t re, mpfr_t im)
+{
+  mpfr_set_prec (g_reference_re, mpfr_get_prec (re));
+  mpfr_set_prec (g_reference_im, mpfr_get_prec (im));
+  mpfr_set (g_reference_re, re, MPFR_RNDN);
+  mpfr_set (g_reference_im, im, MPFR_RNDN);
+
+  g_reference_set = 1;
+  atomic_store (&g_orbit_valid, 0);
+}
+
+// Extends the current orbit to max_iter.  Nothing may be rendering
+// meanwhile and g_orbit_re/g_orbit_im must already have room for
+// max_iter + 1 entries.  Returns 0 when there is no complete orbit to
+// extend.
+int
+render_enqueue_extend (struct thread_pool *pool,
+                       struct thread_pool_group *group, int max_iter)
+{
+  int amount = atomic_load (&g_orbit_amount);
+
+  if (amount == 0 || atomic_load (&g_orbit_valid) != amount
+      || max_iter + 1 < amount)
+    return 0;
+
+  struct orbit_work *work;
+
+  work = render_arena_alloc (sizeof (struct orbit_work));
+
+  work->max_iter = max_iter;
+  work->generation = atomic_load (&g_generation);
+
+  g_secondaries_amount = 0;
+  atomic_store (&g_bla_ready, 0);
+  atomic_store (&g_orbit_amount, max_iter + 1);
+
+  thread_pool_enqueue (pool, group,
+                       g_orbit_direct ? render_direct_orbit_thread
+                                      : render_extend_orbit_thread,
+                       NULL, work);
+
+  return 1;
+}
+
+// Tiles costing over RENDER_TILE_SPLIT times the mean are split in four,
+// down to RENDER_TILE_MIN pixels, and enqueued first; squares of four tiles
+// all under the mean over RENDER_TILE_SPLIT are coalesced into one.
+#define RENDER_TILE_SPLIT 4
+#define RENDER_TILE_MIN 4
+
+struct render_tile
+{
+  int x;
+  int y;
+  int size;
+  long long cost;
+  long long distance;
+  int expensive;
+};
+
+// Nothing may be rendering meanwhile, the orbit is kept.
+void
+render_set_map (int map)
+{
+  g_map = map;
+}
+
+void
+render_set_focus (int x, int y)
+{
+  g_focus_x = x;
+  g_focus_y = y;
+}
+
+// Iterations the tile took last time, from g_cost_last.  Tiles are at least
+// RENDER_COST_CELL and aligned to it.
+static long long
+render_tile_cost (int x, int y, int size)
+{
+  long long cost = 0;
+
+  for (int row = y / RENDER_COST_CELL;
+       row < (y + size) / RENDER_COST_CELL && row < g_cost_rows; ++row)
+    for (int column = x / RENDER_COST_CELL;
+         column < (x + size) / RENDER_COST_CELL && column < g_cost_columns;
+         ++column)
+      cost += g_cost_last[row * g_cost_columns + column];
+
+  return cost;
+}
+
+static void
+render_tile_add (struct render_tile *tiles, int *tiles_amount, int x, int y,
+                 int size, long long cost, int expensive)
+{
+  if (x >= g_width || y >= g_height)
+    return;
+
+  struct render_tile *tile = &tiles[(*tiles_amount)++];
+
+  long long distance_x = x + size / 2 - g_focus_x;
+  long long distance_y = y + size / 2 - g_focus_y;
+
+  tile->x = x;
+  tile->y = y;
+  tile->size = size;
+  tile->cost = cost;
+  tile->distance = distance_x * distance_x + distance_y * distance_y;
+  tile->expensive = expensive;
+}
+
+// Expensive tiles first, most expensive first, then nearest the focus.
+static int
+render_tile_compare (const void *a, const void *b)
+{
+  const struct render_tile *x = a;
+  const struct render_tile *y = b;
+
+  if (x->expensive != y->expensive)
+    return y->expensive - x->expensive;
+
+  if (x->expensive && x->cost != y->cost)
+    return (y->cost > x->cost) - (y->cost < x->cost);
+
+  return (x->distance > y->distance) - (x->distance < y->distance);
+}
+
+// What the work items of a pass over the view share, all but the tile.
+static void
+render_work_base (struct render_work *work, mpfr_t center_re,
+                  mpfr_t center_im, mpfr_t scale, int max_iter)
+{
+  memset (work, 0, sizeof (struct render_work));
+
+  work->step = 1;
+  work->samples = 1;
+  work->max_iter = max_iter;
+
+  work->orbit_re = g_orbit_re;
+  work->orbit_im = g_orbit_im;
+  work->orbit_amount = atomic_load (&g_orbit_amount);
+  work->orbit_escaped = -1;
+
+  work->scale = render_scale (scale);
+  render_offset (center_re, center_im, scale, &work->offset_re,
+                 &work->offset_im);
+  work->period_tolerance = ldexp (1.0, 2 * RENDER_PERIOD_BITS);
+  work->glitch_tolerance = g_orbit_direct ? 0.0 : RENDER_GLITCH_TOLERANCE;
+  work->direct = g_orbit_direct;
+
+  work->generation = atomic_load (&g_generation);
+}
+
+// The work item for the tile of size pixels at x, y of a pass.  Under the
+// exponential map, the scale is that of the tile's first row.
+static void
+render_work_tile (struct render_work *work, const struct render_work *base,
+                  int x, int y, int size)
+{
+  *work = *base;
+
+  work->x = x;
+  work->y = y;
+  work->tile = size;
+
+  if (g_map == RENDER_MAP_EXP)
+    {
+      double zoom = exp (2 * M_PI * y / g_width);
+
+      work->scale = floatexp_mul_d (base->scale, zoom);
+      work->offset_re /= zoom;
+      work->offset_im /= zoom;
+    }
+}
+
+// Enqueues the pixels of the view every step pixels, in tiles scheduled by
+// what they cost last frame.  Work of earlier generations must be finished
+// or cleared, as the work items are reused from then on.
+void
+render_enqueue_pass (struct thread_pool *pool,
+                     struct thread_pool_group *group, int step,
+                     mpfr_t center_re, mpfr_t center_im, mpfr_t scale,
+                     int max_iter)
+{
+  struct render_work base;
+  render_work_base (&base, center_re, center_im, scale, max_iter);
+
+  base.step = step;
+
+  int tile = step;
+  if (tile < 8)
+    tile = 8;
+
+  int tiles_x = (g_width + tile - 1) / tile;
+  int tiles_y = (g_height + tile - 1) / tile;
+
+  long long total = 0;
+
+  for (int y = 0; y < g_height; y += tile)
+    for (int x = 0; x < g_width; x += tile)
+      total += render_tile_cost (x, y, tile);
+
+  long long mean = total / ((long long)tiles_x * tiles_y);
+
+  // Every tile may be split in four.
+  struct render_tile *tiles
+      = malloc ((size_t)4 * tiles_x * tiles_y * sizeof (struct render_tile));
+  int tiles_amount = 0;
+
+  for (int y = 0; y < g_height; y += 2 * tile)
+    for (int x = 0; x < g_width; x += 2 * tile)
+      {
+        long long costs[4];
+        int cheap = total > 0;
+
+        for (int i = 0; i < 4; ++i)
+          {
+            costs[i] = render_tile_cost (x + (i & 1) * tile,
+                                         y + (i >> 1) * tile, tile);
+
+            if (costs[i] * RENDER_TILE_SPLIT >= mean)
+              cheap = 0;
+          }
+
+        if (cheap)
+          {
+            render_tile_add (tiles, &tiles_amount, x, y, 2 * tile,
+                             costs[0] + costs[1] + costs[2] + costs[3], 0);
+            continue;
+          }
+
+        for (int i = 0; i < 4; ++i)
+          {
+            int tile_x = x + (i & 1) * tile;
+            int tile_y = y + (i >> 1) * tile;
+            int expensive = total > 0 && costs[i] > RENDER_TILE_SPLIT * mean;
+            int half = tile / 2;
+
+            if (!expensive || half < step || half < RENDER_TILE_MIN)
+              {
+                render_tile_add (tiles, &tiles_amount, tile_x, tile_y, tile,
+                                 costs[i], expensive);
+                continue;
+              }
+
+            for (int j = 0; j < 4; ++j)
+              render_tile_add (tiles, &tiles_amount,
+                               tile_x + (j & 1) * half,
+                               tile_y + (j >> 1) * half, half, costs[i] / 4,
+                               1);
+          }
+      }
+
+  qsort (tiles, tiles_amount, sizeof (struct render_tile),
+         render_tile_compare);
+
+  void **works = render_arena_alloc ((size_t)tiles_amount * sizeof (void *));
+
+  for (int i = 0; i < tiles_amount; ++i)
+    {
+      struct render_work *work;
+      work = render_arena_alloc (sizeof (struct render_work));
+
+      render_work_tile (work, &base, tiles[i].x, tiles[i].y,
+                        tiles[i].size);
+
+      works[i] = work;
+    }
+
+  thread_pool_enqueue_batch (pool, group, render_test, NULL, works,
+                             tiles_amount);
+
+  free (tiles);
+}
+
+// Enqueues a pass taking samples samples, up to RENDER_SAMPLES_MAX, of the
+// pixels on an edge in the view, once the passes of the generation
+// painted all of it.  Pixels already supersampled are left alone.
+void
+render_enqueue_supersample (struct thread_pool *pool,
+                            struct thread_pool_group *group, int samples,
+                            mpfr_t center_re, mpfr_t center_im,
+                            mpfr_t scale, int max_iter)
+{
+  if (samples > RENDER_SAMPLES_MAX)
+    samples = RENDER_SAMPLES_MAX;
+
+  if (samples < 2)
+    return;
+
+  if (!g_samples)
+    g_samples = malloc ((size_t)g_width * g_height * (RENDER_SAMPLES_MAX - 1)
+                        * sizeof (struct render_sample));
+
+  struct render_work base;
+  render_work_base (&base, center_re, center_im, scale, max_iter);
+
+  base.samples = samples;
+
+  int tile = RENDER_DIRTY_CELL;
+  int tiles_x = (g_width + tile - 1) / tile;
+  int tiles_y = (g_height + tile - 1) / tile;
+
+  void **works = render_arena_alloc ((size_t)tiles_x * tiles_y
+                                     * sizeof (void *));
+
+  for (int i = 0; i < tiles_x * tiles_y; ++i)
+    {
+      struct render_work *work;
+      work = render_arena_alloc (sizeof (struct render_work));
+
+      render_work_tile (work, &base, i % tiles_x * tile, i / tiles_x * tile,
+                        tile);
+
+      works[i] = work;
+    }
+
+  thread_pool_enqueue_batch (pool, group, render_test, NULL, works,
+                             tiles_x * tiles_y);
+}
+
+// Picks the palette preset, wrapping around, how many of its colors an
+// iteration goes through and how far into it the coloring starts.  The
+// frame keeps its colors until render_enqueue_color.
+void
+render_set_coloring (int palette, double frequency, double offset)
+{
+  palette %= g_palettes_amount;
+
+  if (palette < 0)
+    palette += g_palettes_amount;
+
+  atomic_store (&g_coloring_palette, palette);
+  atomic_store (&g_coloring_frequency, frequency);
+  atomic_store (&g_coloring_offset, offset);
+
+  atomic_fetch_add (&g_coloring_version, 1);
+}
+
+struct render_color_work
+{
+  int y;
+};
+
+// Colors a band of RENDER_DIRTY_CELL rows from what the passes painted.
+static void
+render_color_thread (void *argument)
+{
+  const struct render_color_work *work = argument;
+
+  struct render_coloring coloring;
+  render_coloring_load (&coloring);
+
+  // Passes painting meanwhile either see the new version, or stored their
+  // values and colors before this fence, see render_paint.
+  atomic_thread_fence (memory_order_seq_cst);
+
+  for (int y = work->y; y < work->y + RENDER_DIRTY_CELL && y < g_height; ++y)
+    for (int x = 0; x < g_width; ++x)
+      {
+        size_t index = (size_t)y * g_width + x;
+
+        atomic_store_explicit (&pixels[index],
+                               render_pixel_color (&coloring, index),
+                               memory_order_relaxed);
+      }
+
+  for (int x = 0; x < g_width; x += RENDER_DIRTY_CELL)
+    render_mark_dirty (x, work->y, RENDER_DIRTY_CELL);
+}
+
+// Colors the whole frame anew, as after render_set_coloring; no pixel is
+// iterated again.  Passes still running may go on meanwhile.
+void
+render_enqueue_color (struct thread_pool *pool,
+                      struct thread_pool_group *group)
+{
+  int bands = (g_height + RENDER_DIRTY_CELL - 1) / RENDER_DIRTY_CELL;
+
+  void **works = render_arena_alloc ((size_t)bands * sizeof (void *));
+
+  for (int i = 0; i < bands; ++i)
+    {
+      struct render_color_work *work;
+      work = render_arena_alloc (sizeof (struct render_color_work));
+
+      work->y = i * RENDER_DIRTY_CELL;
+
+      works[i] = work;
+    }
+
+  thread_pool_enqueue_batch (pool, group, render_color_thread, NULL, works,
+                             bands);
+}
+
+// Where pixel x of the frame to come lies in the last frame, along an axis
+// of size pixels, see render_reproject.
+static double
+render_reproject_from (int x, int size, int zoom, int shift)
+{
+  return ldexp (x - size / 2, zoom) + size / 2 + shift;
+}
+
+static int
+render_reproject_valid (double from, int size)
+{
+  return from == floor (from) && from >= 0 && from < size;
+}
+
+// Starts the frame of the current generation from the last one, for a view
+// centered shift pixels of the last frame away from its center, at 2^zoom
+// times its pixel spacing; zoom is -1, 0 or 1.  Pixels that land exactly on
+// one computed for the last frame keep it, the others are left to the
+// passes as after render_reset.  Samples are only kept when the pixel
+// spacing stays.  Nothing may be rendering meanwhile, and max_iter and the
+// coloring must stay the same.  Returns the amount of pixels kept.
+long long
+render_reproject (int zoom, int shift_x, int shift_y)
+{
+  int generation = atomic_load (&g_generation);
+  long long kept = 0;
+
+  render_cost_snapshot ();
+
+  // Odd sizes put the centers of the two frames half a pixel apart.
+  if (zoom != 0 && (g_width % 2 != 0 || g_height % 2 != 0))
+    {
+      render_reset ();
+      return 0;
+    }
+
+  struct render_coloring coloring;
+  render_coloring_load (&coloring);
+
+  // The row a new one comes from is copied first, the rows are gone through
+  // so that none is overwritten before the ones coming from it.
+  int32_t *row_iter = malloc ((size_t)g_width * sizeof (int32_t));
+  float *row_smooth = malloc ((size_t)g_width * sizeof (float));
+  int64_t *row_done = malloc ((size_t)g_width * sizeof (int64_t));
+  double *row_zn2 = malloc ((size_t)g_width * sizeof (double));
+  struct render_pixel_state *row_state
+      = malloc ((size_t)g_width * sizeof (struct render_pixel_state));
+  unsigned char *row_amount = malloc (g_width);
+  struct render_sample *row_samples
+      = g_samples ? malloc ((size_t)g_width * (RENDER_SAMPLES_MAX - 1)
+                            * sizeof (struct render_sample))
+                  : NULL;
+
+  for (int phase = 0; phase < 2; ++phase)
+    for (int i = 0; i < g_height; ++i)
+      {
+        int y = phase == 0 ? i : g_height - 1 - i;
+        double from_y = render_reproject_from (y, g_height, zoom, shift_y);
+
+        if ((from_y >= y) != (phase == 0))
+          continue;
+
+        int row_valid = render_reproject_valid (from_y, g_height);
+
+        if (row_valid)
+          {
+            size_t from = (size_t)from_y * g_width;
+
+            memcpy (row_zn2, &pixels_zn2[from],
+                    (size_t)g_width * sizeof (double));
+            memcpy (row_state, &pixels_state[from],
+                    (size_t)g_width * sizeof (struct render_pixel_state));
+
+            for (int x = 0; x < g_width; ++x)
+              {
+                row_iter[x] = atomic_load_explicit (&pixels_iter[from + x],
+                                                    memory_order_relaxed);
+                row_smooth[x] = atomic_load_explicit (
+                    &pixels_smooth[from + x], memory_order_relaxed);
+                row_done[x] = atomic_load_explicit (&pixels_done[from + x],
+                                                    memory_order_relaxed);
+                row_amount[x] = atomic_load_explicit (
+                    &g_samples_amount[from + x], memory_order_relaxed);
+              }
+
+            if (row_samples)
+              memcpy (row_samples, &g_samples[from * (RENDER_SAMPLES_MAX - 1)],
+                      (size_t)g_width * (RENDER_SAMPLES_MAX - 1)
+                          * sizeof (struct render_sample));
+          }
+
+        for (int x = 0; x < g_width; ++x)
+          {
+            size_t index = (size_t)y * g_width + x;
+            double from_x = render_reproject_from (x, g_width, zoom, shift_x);
+            int from = (int)from_x;
+
+            int64_t done = -1;
+
+            if (row_valid && render_reproject_valid (from_x, g_width)
+                && row_done[from] != -1
+                && (int)(row_done[from] >> 32) == g_frame_generation)
+              done = (int64_t)generation << 32 | (uint32_t)row_done[from];
+
+            if (done == -1)
+              {
+                atomic_store_explicit (&pixels[index], 0,
+                                       memory_order_relaxed);
+                atomic_store_explicit (&pixels_iter[index], -2,
+                                       memory_order_relaxed);
+                atomic_store_explicit (&g_samples_amount[index], 0,
+                                       memory_order_relaxed);
+                atomic_store_explicit (&pixels_done[index], -1,
+                                       memory_order_relaxed);
+                continue;
+              }
+
+            atomic_store_explicit (&pixels_iter[index], row_iter[from],
+                                   memory_order_relaxed);
+            atomic_store_explicit (&pixels_smooth[index], row_smooth[from],
+                                   memory_order_relaxed);
+            pixels_zn2[index] = row_zn2[from];
+            pixels_state[index] = row_state[from];
+            atomic_store_explicit (&pixels_done[index], done,
+                                   memory_order_relaxed);
+
+            int amount = zoom == 0 ? row_amount[from] : 0;
+
+            if (amount)
+              memcpy (&g_samples[index * (RENDER_SAMPLES_MAX - 1)],
+                      &row_samples[(size_t)from * (RENDER_SAMPLES_MAX - 1)],
+                      amount * sizeof (struct render_sample));
+
+            atomic_store_explicit (&g_samples_amount[index], amount,
+                                   memory_order_relaxed);
+
+            atomic_store_explicit (&pixels[index],
+                                   render_pixel_color (&coloring, index),
+                                   memory_order_relaxed);
+            kept++;
+          }
+      }
+
+  free (row_iter);
+  free (row_smooth);
+  free (row_done);
+  free (row_zn2);
+  free (row_state);
+  free (row_amount);
+  free (row_samples);
+
+  for (int i = 0; i < g_dirty_columns * g_dirty_rows; ++i)
+    atomic_store (&g_dirty[i], 1);
+
+  g_frame_generation = generation;
+
+  return kept;
+}
+
+// Takes up to capacity rectangles of pixels changed since the last call,
+// runs of changed cells within a row of cells.  Cells that do not fit stay
+// marked for the next call.  Returns the amount of rectangles.
+int
+render_take_dirty (struct render_rect *rects, int capacity)
+{
+  int amount = 0;
+
+  for (int row = 0; row < g_dirty_rows; ++row)
+    for (int column = 0; column < g_dirty_columns; ++column)
+      {
+        if (!atomic_load_explicit (&g_dirty[row * g_dirty_columns + column],
+                                   memory_order_relaxed))
+          continue;
+
+        if (amount == capacity)
+          return amount;
+
+        int end = column;
+
+        // Clearing before reading the pixels: a tile painting meanwhile
+        // marks the cell again.
+        while (end < g_dirty_columns
+               && atomic_exchange_explicit (
+                   &g_dirty[row * g_dirty_columns + end], 0,
+                   memory_order_acquire))
+          end++;
+
+        struct render_rect *rect = &rects[amount++];
+
+        rect->x = column * RENDER_DIRTY_CELL;
+        rect->y = row * RENDER_DIRTY_CELL;
+        rect->width = (end - column) * RENDER_DIRTY_CELL;
+        rect->height = RENDER_DIRTY_CELL;
+
+        if (rect->x + rect->width > g_width)
+          rect->width = g_width - rect->x;
+
+        if (rect->y + rect->height > g_height)
+          rect->height = g_height - rect->y;
+
+        column = end;
+      }
+
+  return amount;
+}
+
+int
+render_write_ppm (const char *path)
+{
+  FILE *file = fopen (path, "wb");
+
+  if (!file)
+    return -1;
+
+  fprintf (file, "P6\n%d %d\n255\n", g_width, g_height);
+
+  for (size_t i = 0; i < (size_t)g_width * g_height; ++i)
+    {
+      uint8_t rgb[3];
+      uint32_t pixel = atomic_load_explicit (&pixels[i], memory_order_relaxed);
+
+      rgb[0] = (pixel >> 16) & 0xFF;
+      rgb[1] = (pixel >> 8) & 0xFF;
+      rgb[2] = pixel & 0xFF;
+
+      fwrite (rgb, 1, sizeof rgb, file);
+    }
+
+  if (fclose (file) != 0)
+    return -1;
+
+  return 0;
+}
@@ -0,0 +1,198 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <mpfr.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "bla.h"
+#include "floatexp.h"
+
+// MPFR precision of the view center and the reference orbit, see
+// render_precision.
+#define PRECISION_MIN 64
+#define PRECISION_MARGIN 64
+#define ESCAPE_RADIUS 1e6
+
+struct thread_pool;
+struct thread_pool_group;
+
+extern atomic_int g_generation;
+extern atomic_bool g_orbit_ready;
+
+// The reference orbit for max_iter iterations has max_iter + 1 entries, the
+// last one for the step that reaches max_iter.
+extern double *g_orbit_re;
+extern double *g_orbit_im;
+extern atomic_int g_orbit_amount;
+
+// The first g_orbit_valid of the g_orbit_amount entries are computed; pixel
+// work follows it while the orbit is streamed in.  The BLA table g_bla is
+// only usable once g_bla_ready is set.
+extern atomic_int g_orbit_valid;
+extern atomic_bool g_bla_ready;
+
+extern int g_width;
+extern int g_height;
+
+// Painted by the tiles without locking.  The tiles of one pass are
+// disjoint, but a coarse block covers pixels finer passes compute at the
+// same time, so all of it is atomic, and a pixel ends up painted from its
+// own values whatever the order, see render_paint.  The regions changed
+// since they were last taken come from render_take_dirty.  pixels_mutex
+// guards the orbit state render_orbit_finish publishes.
+extern _Atomic uint32_t *pixels;
+extern pthread_mutex_t pixels_mutex;
+
+// What the colors in pixels are made of, painted over the same blocks: the
+// iteration a pixel escaped at, -1 where it did not escape or -2 where no
+// pass got to it yet, and the fraction pixels_smooth that makes the count
+// continuous.  Recoloring needs nothing else.
+extern _Atomic int32_t *pixels_iter;
+extern _Atomic float *pixels_smooth;
+
+// How pixel x, y maps to a point, around the center at pixel spacing
+// scale: RENDER_MAP_VIEW is the plain rectangle, RENDER_MAP_EXP the
+// exponential map, with columns going once around the center and rows out
+// from it, each row e^(2 pi / g_width) times as far out as the one before.
+// Row 0 is g_width / 2 pi pixel spacings out.
+#define RENDER_MAP_VIEW 0
+#define RENDER_MAP_EXP 1
+
+struct render_rect
+{
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+// Per pixel: the generation that computed it in the high 32 bits and its
+// final iteration count in the low 32, or -1.  pixels_zn2 holds the matching
+// |z|^2 for smoothing and is published by the release store to pixels_done.
+extern _Atomic int64_t *pixels_done;
+extern double *pixels_zn2;
+
+// Where a pixel that stopped at max_iter was, so it can be resumed when
+// max_iter is raised; iter is -1 for pixels that escaped, RENDER_INTERIOR
+// for pixels found on an attracting cycle, which stay at any max_iter, and
+// RENDER_RESTART for pixels iterated against a secondary reference, which
+// start over.
+#define RENDER_INTERIOR -2
+#define RENDER_RESTART -3
+
+struct render_pixel_state
+{
+  double dz_re;
+  double dz_im;
+  long dz_exp;
+  int iter;
+  int iter_orbit;
+};
+
+extern struct render_pixel_state *pixels_state;
+
+extern atomic_llong g_stat_iterations;
+extern atomic_llong g_stat_rebases;
+
+extern struct bla_table g_bla;
+
+// Where reference orbits are looked up before being computed and stored
+// after, or NULL.
+struct orbit_cache;
+extern struct orbit_cache *g_orbit_cache;
+
+struct orbit_work
+{
+  struct floatexp scale;
+  double offset_re;
+  double offset_im;
+  int max_iter;
+  int generation;
+};
+
+struct render_work
+{
+  int x;
+  int y;
+  int tile;
+  int step;
+  int samples;
+  int max_iter;
+  struct floatexp scale;
+  double offset_re;
+  double offset_im;
+  double *orbit_re;
+  double *orbit_im;
+  int orbit_amount;
+  // Last entry of the orbit to follow before rebasing: the one its reference
+  // escaped right after, or the last of a complete orbit; -1 while the orbit
+  // is incomplete.
+  int orbit_escaped;
+  // Squared distance relative to z at the save within which z counts as
+  // repeated, see RENDER_PERIOD_BITS in render.c, or 0 not to look for
+  // cycles.
+  double period_tolerance;
+  // |z|^2 relative to |dz|^2 where a rebasing pixel counts as glitched, see
+  // RENDER_GLITCH_TOLERANCE in render.c, or 0 not to look for glitches.
+  double glitch_tolerance;
+  const struct bla_table *bla;
+  // Set where the orbit is the one of 0, see RENDER_DIRECT_EXP in render.c:
+  // dz is z itself and the lanes leave the orbit out.
+  int direct;
+  int generation;
+};
+
+void render_init (int, int);
+
+void render_quit (void);
+
+void render_reset (void);
+
+void render_resume (void);
+
+long long render_reproject (int, int, int);
+
+void render_compute_orbit (mpfr_t, mpfr_t, double *, double *, int, int);
+
+void render_compute_orbit_thread (void *);
+
+void render_reuse_orbit_thread (void *);
+
+void render_extend_orbit_thread (void *);
+
+void render_direct_orbit_thread (void *);
+
+void render_test (void *);
+
+int render_precision (mpfr_t);
+
+void render_enqueue_orbit (struct thread_pool *, struct thread_pool_group *,
+                           mpfr_t, mpfr_t, mpfr_t, int);
+
+void render_set_reference (mpfr_t, mpfr_t);
+
+int render_enqueue_extend (struct thread_pool *, struct thread_pool_group *,
+                           int);
+
+void render_enqueue_pass (struct thread_pool *, struct thread_pool_group *,
+                          int, mpfr_t, mpfr_t, mpfr_t, int);
+
+void render_enqueue_supersample (struct thread_pool *,
+                                 struct thread_pool_group *, int, mpfr_t,
+                                 mpfr_t, mpfr_t, int);
+
+void render_set_coloring (int, double, double);
+
+void render_enqueue_color (struct thread_pool *, struct thread_pool_group *);
+
+void render_set_map (int);
+
+void render_set_focus (int, int);
+
+int render_take_dirty (struct render_rect *, int);
+
+int render_write_ppm (const char *);
+
+#endif // RENDER_H
@@ -0,0 +1,233 @@
+#include <math.h>
+#include <mpfr.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "orbit-cache.h"
+#include "render.h"
+#include "thread-pool.h"
+
+// The sequence ends with the frame that shows everything within
+// SEQUENCE_RADIUS of its center.
+#define SEQUENCE_RADIUS 4.0
+
+static void
+usage (const char *program)
+{
+  fprintf (stderr,
+           "usage: %s <center_re> <center_im> <scale> <max_iter> <width> "
+           "<height> <zoom> [threads [samples]]\n",
+           program);
+}
+
+// Renders the keyframe at pixel spacing scale into pixels, starting from
+// the one before it unless it is the first.
+static void
+sequence_keyframe (struct thread_pool *pool, mpfr_t center_re,
+                   mpfr_t center_im, mpfr_t scale, int max_iter, int samples,
+                   int first)
+{
+  atomic_fetch_add (&g_generation, 1);
+
+  if (first)
+    render_reset ();
+  else
+    render_reproject (1, 0, 0);
+
+  render_enqueue_orbit (pool, NULL, center_re, center_im, scale, max_iter);
+  render_enqueue_pass (pool, NULL, 1, center_re, center_im, scale, max_iter);
+  thread_pool_wait (pool);
+
+  render_enqueue_supersample (pool, NULL, samples, center_re, center_im,
+                              scale, max_iter);
+  thread_pool_wait (pool);
+}
+
+// Color of the keyframe at x, y, interpolated between its pixels.  Points
+// past the edges take the nearest edge.
+static void
+sequence_sample (const uint32_t *keyframe, double x, double y, double *rgb)
+{
+  x = fmin (fmax (x, 0.0), g_width - 1);
+  y = fmin (fmax (y, 0.0), g_height - 1);
+
+  int column = (int)x;
+  int row = (int)y;
+  int next_column = column + 1 < g_width ? column + 1 : column;
+  int next_row = row + 1 < g_height ? row + 1 : row;
+  double frac_x = x - column;
+  double frac_y = y - row;
+
+  uint32_t p00 = keyframe[(size_t)row * g_width + column];
+  uint32_t p01 = keyframe[(size_t)row * g_width + next_column];
+  uint32_t p10 = keyframe[(size_t)next_row * g_width + column];
+  uint32_t p11 = keyframe[(size_t)next_row * g_width + next_column];
+
+  for (int c = 0; c < 3; ++c)
+    {
+      int shift = 16 - 8 * c;
+
+      double c00 = (p00 >> shift) & 0xFF;
+      double c01 = (p01 >> shift) & 0xFF;
+      double c10 = (p10 >> shift) & 0xFF;
+      double c11 = (p11 >> shift) & 0xFF;
+
+      double top = c00 + (c01 - c00) * frac_x;
+      double bottom = c10 + (c11 - c10) * frac_x;
+
+      rgb[c] = top + (bottom - top) * frac_y;
+    }
+}
+
+// Writes the frame at ratio times the pixel spacing of keyframe, ratio
+// being at least 1 and under 2, to stdout.  What keyframe does not cover
+// comes from outer, the keyframe after it.
+static int
+sequence_frame (const uint32_t *keyframe, const uint32_t *outer,
+                double ratio, uint8_t *frame)
+{
+  for (int y = 0; y < g_height; ++y)
+    for (int x = 0; x < g_width; ++x)
+      {
+        double key_x = (x - g_width / 2) * ratio + g_width / 2;
+        double key_y = (y - g_height / 2) * ratio + g_height / 2;
+        double rgb[3];
+
+        if (key_x <= g_width - 1 && key_y <= g_height - 1 && key_x >= 0
+            && key_y >= 0)
+          sequence_sample (keyframe, key_x, key_y, rgb);
+        else
+          sequence_sample (outer, (x - g_width / 2) * ratio / 2 + g_width / 2,
+                           (y - g_height / 2) * ratio / 2 + g_height / 2,
+                           rgb);
+
+        uint8_t *pixel = &frame[((size_t)y * g_width + x) * 3];
+
+        for (int c = 0; c < 3; ++c)
+          pixel[c] = (uint8_t)(rgb[c] + 0.5);
+      }
+
+  size_t amount = (size_t)g_width * g_height;
+
+  return fwrite (frame, 3, amount, stdout) == amount ? 0 : -1;
+}
+
+int
+main (int argc, char **argv)
+{
+  if (argc < 8 || argc > 10)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  int max_iter = atoi (argv[4]);
+  int width = atoi (argv[5]);
+  int height = atoi (argv[6]);
+  double zoom = atof (argv[7]);
+
+  int threads = argc >= 9 ? atoi (argv[8])
+                          : (int)sysconf (_SC_NPROCESSORS_ONLN);
+  int samples = argc == 10 ? atoi (argv[9]) : 1;
+
+  // Keyframes share every other pixel only with even sizes.
+  if (max_iter <= 0 || width <= 0 || height <= 0 || width % 2 != 0
+      || height % 2 != 0 || !(zoom > 1.0) || threads <= 0 || samples <= 0)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  mpfr_t center_re, center_im, scale;
+  mpfr_init2 (scale, 64);
+
+  if (mpfr_set_str (scale, argv[3], 10, MPFR_RNDN) != 0
+      || mpfr_sgn (scale) <= 0)
+    {
+      fprintf (stderr, "%s: invalid scale\n", argv[0]);
+      mpfr_clear (scale);
+      return 1;
+    }
+
+  mpfr_inits2 (render_precision (scale), center_re, center_im, (mpfr_ptr)0);
+
+  if (mpfr_set_str (center_re, argv[1], 10, MPFR_RNDN) != 0
+      || mpfr_set_str (center_im, argv[2], 10, MPFR_RNDN) != 0)
+    {
+      fprintf (stderr, "%s: invalid center\n", argv[0]);
+      mpfr_clears (center_re, center_im, scale, (mpfr_ptr)0);
+      return 1;
+    }
+
+  // Frame n is zoom^n times as shallow as the first, keyframe k 2^k times.
+  long exp;
+  double mant = mpfr_get_d_2exp (&exp, scale, MPFR_RNDN);
+  double step = log2 (zoom);
+  double top = log2 (SEQUENCE_RADIUS / hypot (width / 2.0, height / 2.0))
+               - exp - log2 (mant);
+  long frames = top > 0.0 ? (long)ceil (top / step) + 1 : 1;
+
+  render_init (width, height);
+
+  g_orbit_cache = orbit_cache_create (NULL, ORBIT_CACHE_LIMIT);
+
+  g_orbit_re = calloc (max_iter + 1, sizeof (double));
+  g_orbit_im = calloc (max_iter + 1, sizeof (double));
+
+  struct thread_pool *pool;
+
+  pool = thread_pool_create (threads, 32768 * 8);
+
+  size_t amount = (size_t)width * height;
+  uint32_t *keyframe = malloc (amount * sizeof (uint32_t));
+  uint32_t *outer = malloc (amount * sizeof (uint32_t));
+  uint8_t *frame = malloc (amount * 3);
+
+  sequence_keyframe (pool, center_re, center_im, scale, max_iter, samples,
+                     1);
+
+  int status = 0;
+  long frame_index = 0;
+
+  for (int k = 0; status == 0 && frame_index < frames; ++k)
+    {
+      memcpy (keyframe, pixels, amount * sizeof (uint32_t));
+
+      mpfr_mul_2ui (scale, scale, 1, MPFR_RNDN);
+      sequence_keyframe (pool, center_re, center_im, scale, max_iter, samples,
+                         0);
+      memcpy (outer, pixels, amount * sizeof (uint32_t));
+
+      for (; status == 0 && frame_index < frames
+             && frame_index * step < k + 1;
+           ++frame_index)
+        if (sequence_frame (keyframe, outer, exp2 (frame_index * step - k),
+                            frame)
+            != 0)
+          {
+            perror ("stdout");
+            status = 1;
+          }
+    }
+
+  free (keyframe);
+  free (outer);
+  free (frame);
+
+  thread_pool_destroy (pool);
+
+  orbit_cache_destroy (g_orbit_cache);
+
+  free (g_orbit_re);
+  free (g_orbit_im);
+
+  render_quit ();
+
+  mpfr_clears (center_re, center_im, scale, (mpfr_ptr)0);
+
+  return status;
+}
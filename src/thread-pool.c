@@ -1,13 +1,80 @@
 #include "thread-pool.h"
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 
 
+// Enqueuing is serialized by the pool mutex and appends to the shared
+// queue, while workers take work without it.  Every worker has its own
+// deque, which it takes from at the bottom, and which other workers steal
+// from at the top once theirs is empty.  A worker with an empty deque first
+// takes a chunk from the front of the shared queue instead: it runs the
+// oldest work of it right away and pushes the rest youngest first, so it
+// takes that oldest first too while thieves take the youngest.
+//
+// Work thus starts about in the order it was enqueued, and the oldest work
+// not finished always gets a worker: the shared queue is taken in order,
+// and a worker only runs younger work than what is in its deque once that
+// has been stolen.  Work that waits on earlier work, like pixels on their
+// orbit, can therefore not hold up all the workers.
+
+// Slots of a deque, and thus the most work taken from the shared queue at
+// once.
+#define THREAD_POOL_DEQUE_CAPACITY 256
+
+
+// A queue slot.  Its fields are atomic as a worker may read a slot that is
+// being refilled, and then fails to take it.
 struct thread_pool_work
+{
+  void (*_Atomic                     function) (void *);
+  void (*_Atomic                     drop) (void *);
+  void *_Atomic                      argument;
+  struct thread_pool_group *_Atomic  group;
+};
+
+
+// A slot as taken from a queue.
+struct thread_pool_task
 {
   void (*function) (void *);
+  void (*drop) (void *);
   void  *argument;
+  struct thread_pool_group *group;
+};
+
+
+struct thread_pool_group
+{
+  pthread_mutex_t  mutex;
+  pthread_cond_t   cond;
+
+  atomic_int       pending;
+};
+
+
+struct thread_pool_queue
+{
+  _Alignas (64) atomic_uint  head;
+  _Alignas (64) atomic_uint  tail;
+
+  struct thread_pool_work   *works;
+  unsigned                   mask;
+};
+
+
+// A Chase-Lev deque: its worker pushes and takes at bottom, others steal at
+// top.
+struct thread_pool_deque
+{
+  _Alignas (64) atomic_long  top;
+  _Alignas (64) atomic_long  bottom;
+
+  struct thread_pool_work    works[THREAD_POOL_DEQUE_CAPACITY];
+
+  struct thread_pool        *pool;
+  int                        index;
 };
 
 
@@ -15,16 +82,32 @@ struct thread_pool
 {
   pthread_mutex_t           mutex;
   pthread_cond_t            cond;
+  pthread_cond_t            cond_idle;
+  pthread_cond_t            cond_space;
 
   pthread_t                *threads;
   int                       threads_amount;
   atomic_int                threads_active;
 
-  struct thread_pool_work  *queue;
-  int                       queue_capacity;
-  int                       queue_size;
-  int                       queue_head;
-  int                       queue_tail;
+  struct thread_pool_queue  queue;
+  struct thread_pool_deque *deques;
+
+  // Work in the queue and deques or on its way between them, and that or
+  // running.
+  atomic_int                queued;
+  atomic_int                pending;
+
+  // Workers between taking a chunk off the queue and having it in their
+  // deque, which thread_pool_clear waits out.
+  atomic_int                taking;
+
+  // Moved whenever work shows up to be taken, enqueued or put into a deque,
+  // for the workers sleeping on cond, see thread_pool_wake.
+  atomic_uint               epoch;
+  atomic_int                sleeping;
+
+  // Enqueuers waiting on cond_space for the queue to drain.
+  atomic_int                space_waiting;
 
   int                       stop;
 };
@@ -42,22 +125,56 @@ thread_pool_create (int threads_amount, int queue_capacity)
 
   pthread_mutex_init (&pool->mutex, NULL);
   pthread_cond_init (&pool->cond, NULL);
+  pthread_cond_init (&pool->cond_idle, NULL);
+  pthread_cond_init (&pool->cond_space, NULL);
 
   pool->threads = calloc (threads_amount, sizeof (pthread_t));
 
   pool->threads_amount = threads_amount;
   atomic_init (&pool->threads_active, 0);
 
-  pool->queue = calloc (queue_capacity, sizeof (struct thread_pool_work));
-  pool->queue_capacity = queue_capacity;
-  pool->queue_size = 0;
-  pool->queue_head = 0;
-  pool->queue_tail = 0;
+  // Rounded up to a power of two.
+  unsigned capacity = 1;
+
+  while (capacity < (unsigned)queue_capacity)
+    capacity *= 2;
+
+  atomic_init (&pool->queue.head, 0);
+  atomic_init (&pool->queue.tail, 0);
+
+  pool->queue.works = calloc (capacity, sizeof (struct thread_pool_work));
+  pool->queue.mask = capacity - 1;
+
+  pool->deques = aligned_alloc (_Alignof (struct thread_pool_deque),
+                                threads_amount
+                                    * sizeof (struct thread_pool_deque));
+
+  for (int i = 0; i < threads_amount; ++i)
+    {
+      struct thread_pool_deque *deque = &pool->deques[i];
+
+      atomic_init (&deque->top, 0);
+      atomic_init (&deque->bottom, 0);
+
+      deque->pool = pool;
+      deque->index = i;
+    }
+
+  atomic_init (&pool->queued, 0);
+  atomic_init (&pool->pending, 0);
+
+  atomic_init (&pool->taking, 0);
+
+  atomic_init (&pool->epoch, 0);
+  atomic_init (&pool->sleeping, 0);
+
+  atomic_init (&pool->space_waiting, 0);
 
   pool->stop = 0;
 
   for (int i = 0; i < threads_amount; ++i)
-    pthread_create (&pool->threads[i], NULL, thread_pool_thread_work, pool);
+    pthread_create (&pool->threads[i], NULL, thread_pool_thread_work,
+                    &pool->deques[i]);
 
   return pool;
 }
@@ -70,48 +187,416 @@ thread_pool_destroy (struct thread_pool *pool)
 
   pthread_mutex_destroy (&pool->mutex);
   pthread_cond_destroy (&pool->cond);
+  pthread_cond_destroy (&pool->cond_idle);
+  pthread_cond_destroy (&pool->cond_space);
+
+  free (pool->queue.works);
 
   free (pool->threads);
-  free (pool->queue);
+  free (pool->deques);
 
   free (pool);
 }
 
 
+static void
+thread_pool_load (struct thread_pool_work *work, struct thread_pool_task *task)
+{
+  task->function = atomic_load_explicit (&work->function,
+                                         memory_order_relaxed);
+  task->drop = atomic_load_explicit (&work->drop, memory_order_relaxed);
+  task->argument = atomic_load_explicit (&work->argument,
+                                         memory_order_relaxed);
+  task->group = atomic_load_explicit (&work->group, memory_order_relaxed);
+}
+
+
+static void
+thread_pool_store (struct thread_pool_work *work,
+                   const struct thread_pool_task *task)
+{
+  atomic_store_explicit (&work->function, task->function,
+                         memory_order_relaxed);
+  atomic_store_explicit (&work->drop, task->drop, memory_order_relaxed);
+  atomic_store_explicit (&work->argument, task->argument,
+                         memory_order_relaxed);
+  atomic_store_explicit (&work->group, task->group, memory_order_relaxed);
+}
+
+
+// Counts amount works of group as finished.
+static void
+thread_pool_group_finish (struct thread_pool_group *group, int amount)
+{
+  if (!group || amount == 0)
+    return;
+
+  if (atomic_fetch_sub (&group->pending, amount) == amount)
+    {
+      pthread_mutex_lock (&group->mutex);
+      pthread_cond_broadcast (&group->cond);
+      pthread_mutex_unlock (&group->mutex);
+    }
+}
+
+
+// Appends to the shared queue.  Must be called with the mutex held; returns
+// 0 when it is full.
+static int
+thread_pool_push (struct thread_pool *pool,
+                  const struct thread_pool_task *task)
+{
+  struct thread_pool_queue *queue = &pool->queue;
+  unsigned head, tail;
+
+  // Sequentially consistent against the space_waiting check of the workers,
+  // see thread_pool_enqueue_batch.
+  head = atomic_load (&queue->head);
+  tail = atomic_load_explicit (&queue->tail, memory_order_relaxed);
+
+  if (tail - head > queue->mask)
+    return 0;
+
+  thread_pool_store (&queue->works[tail & queue->mask], task);
+
+  // Counted before it can be taken, so no count drops below zero.
+  if (task->group)
+    atomic_fetch_add (&task->group->pending, 1);
+
+  atomic_fetch_add (&pool->pending, 1);
+  atomic_fetch_add (&pool->queued, 1);
+
+  atomic_store_explicit (&queue->tail, tail + 1, memory_order_release);
+
+  return 1;
+}
+
+
+// Takes up to amount works from the front of the shared queue, the oldest
+// into task and the rest into the empty deque of the calling worker,
+// youngest first.  Returns how many, 0 when the queue is empty.
+static int
+thread_pool_queue_take (struct thread_pool_queue *queue,
+                        struct thread_pool_deque *deque,
+                        struct thread_pool_task *task, int amount)
+{
+  long bottom = atomic_load_explicit (&deque->bottom, memory_order_relaxed);
+  unsigned head = atomic_load_explicit (&queue->head, memory_order_acquire);
+
+  while (1)
+    {
+      unsigned tail = atomic_load_explicit (&queue->tail,
+                                            memory_order_acquire);
+
+      if (head == tail)
+        return 0;
+
+      if (tail - head < (unsigned)amount)
+        amount = tail - head;
+
+      // Read before they are taken, as enqueuing may refill them after.
+      // Thieves do not see the deque slots until bottom moves.
+      thread_pool_load (&queue->works[head & queue->mask], task);
+
+      for (int i = 1; i < amount; ++i)
+        {
+          struct thread_pool_task work;
+
+          thread_pool_load (&queue->works[(head + i) & queue->mask], &work);
+          thread_pool_store (&deque->works[(bottom + amount - 1 - i)
+                                           % THREAD_POOL_DEQUE_CAPACITY],
+                             &work);
+        }
+
+      if (atomic_compare_exchange_weak (&queue->head, &head, head + amount))
+        break;
+    }
+
+  atomic_store_explicit (&deque->bottom, bottom + amount - 1,
+                         memory_order_release);
+
+  return amount;
+}
+
+
+// Takes from the bottom of the deque of the calling worker.  Returns 0 when
+// it is empty.
+static int
+thread_pool_deque_take (struct thread_pool_deque *deque,
+                        struct thread_pool_task *task)
+{
+  long bottom = atomic_load_explicit (&deque->bottom, memory_order_relaxed);
+  long top = atomic_load_explicit (&deque->top, memory_order_relaxed);
+
+  if (top >= bottom)
+    return 0;
+
+  // Sequentially consistent against the loads of thieves in the other
+  // order, so either this or the thief sees the other.
+  bottom--;
+  atomic_exchange (&deque->bottom, bottom);
+  top = atomic_load (&deque->top);
+
+  if (top > bottom)
+    {
+      atomic_store_explicit (&deque->bottom, bottom + 1,
+                             memory_order_relaxed);
+      return 0;
+    }
+
+  thread_pool_load (&deque->works[bottom % THREAD_POOL_DEQUE_CAPACITY], task);
+
+  if (top < bottom)
+    return 1;
+
+  // The last one, which a thief may be after too.
+  int taken = atomic_compare_exchange_strong_explicit (
+      &deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+
+  atomic_store_explicit (&deque->bottom, bottom + 1, memory_order_relaxed);
+
+  return taken;
+}
+
+
+// Steals from the top of a deque.  Returns 0 when it is empty or the work
+// went to someone else.
+static int
+thread_pool_deque_steal (struct thread_pool_deque *deque,
+                         struct thread_pool_task *task)
+{
+  long top = atomic_load (&deque->top);
+  long bottom = atomic_load (&deque->bottom);
+
+  if (top >= bottom)
+    return 0;
+
+  thread_pool_load (&deque->works[top % THREAD_POOL_DEQUE_CAPACITY], task);
+
+  return atomic_compare_exchange_strong_explicit (
+      &deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+
+// Wakes the workers sleeping on cond for work that just showed up.  The
+// epoch is moved before sleeping is checked, and the workers count
+// themselves sleeping before they check the epoch, so either this sees them
+// or they see it.
+static void
+thread_pool_wake (struct thread_pool *pool)
+{
+  atomic_fetch_add (&pool->epoch, 1);
+
+  if (atomic_load (&pool->sleeping) > 0)
+    {
+      pthread_mutex_lock (&pool->mutex);
+      pthread_cond_broadcast (&pool->cond);
+      pthread_mutex_unlock (&pool->mutex);
+    }
+}
+
+
+// Returns 1 when some deque has work left to steal.
+static int
+thread_pool_stealable (struct thread_pool *pool)
+{
+  for (int i = 0; i < pool->threads_amount; ++i)
+    if (atomic_load (&pool->deques[i].top)
+        < atomic_load (&pool->deques[i].bottom))
+      return 1;
+
+  return 0;
+}
+
+
+// Takes work for the worker of deque: from its deque, else a chunk of the
+// shared queue, else from the other deques.  Returns 0 when there was none.
+static int
+thread_pool_pop (struct thread_pool_deque *deque,
+                 struct thread_pool_task *task)
+{
+  struct thread_pool *pool = deque->pool;
+
+  if (thread_pool_deque_take (deque, task))
+    return 1;
+
+  // About an equal share of what is queued for every worker, twice over,
+  // for them to take turns on the queue.
+  int amount = atomic_load_explicit (&pool->queued, memory_order_relaxed)
+                   / (2 * pool->threads_amount)
+               + 1;
+
+  if (amount > THREAD_POOL_DEQUE_CAPACITY)
+    amount = THREAD_POOL_DEQUE_CAPACITY;
+
+  // The deque is empty, as only its worker fills it.
+  atomic_fetch_add (&pool->taking, 1);
+
+  int taken = thread_pool_queue_take (&pool->queue, deque, task, amount);
+
+  atomic_fetch_sub (&pool->taking, 1);
+
+  if (taken > 1)
+    thread_pool_wake (pool);
+
+  if (taken > 0)
+    {
+      // Enqueuers check for room after adding to space_waiting.
+      if (atomic_load (&pool->space_waiting) > 0)
+        {
+          pthread_mutex_lock (&pool->mutex);
+          pthread_cond_broadcast (&pool->cond_space);
+          pthread_mutex_unlock (&pool->mutex);
+        }
+
+      return 1;
+    }
+
+  for (int i = 1; i < pool->threads_amount; ++i)
+    {
+      int victim = (deque->index + i) % pool->threads_amount;
+
+      if (thread_pool_deque_steal (&pool->deques[victim], task))
+        return 1;
+    }
+
+  return 0;
+}
+
+
 void
-thread_pool_enqueue (struct thread_pool *pool, void (*function) (void *),
+thread_pool_enqueue (struct thread_pool *pool,
+                     struct thread_pool_group *group,
+                     void (*function) (void *), void (*drop) (void *),
                      void *argument)
+{
+  thread_pool_enqueue_batch (pool, group, function, drop, &argument, 1);
+}
+
+
+// Enqueues function once for each of the arguments, taking the lock and
+// waking the workers once for all of them.  When the queue is full it
+// waits for it to drain.  drop, if not NULL, is called instead of
+// function on the arguments of work that is cleared or not enqueued since
+// the pool stopped.
+void
+thread_pool_enqueue_batch (struct thread_pool *pool,
+                           struct thread_pool_group *group,
+                           void (*function) (void *), void (*drop) (void *),
+                           void **arguments, int arguments_amount)
 {
   pthread_mutex_lock (&pool->mutex);
 
-  if (pool->queue_size == pool->queue_capacity || pool->stop)
+  struct thread_pool_task task;
+
+  task.function = function;
+  task.drop = drop;
+  task.group = group;
+
+  int pushed = 0;
+
+  while (pushed < arguments_amount && !pool->stop)
     {
-      pthread_mutex_unlock (&pool->mutex);
-      return;
-    }
+      task.argument = arguments[pushed];
 
-  struct thread_pool_work work;
+      if (thread_pool_push (pool, &task))
+        {
+          pushed++;
+          continue;
+        }
+
+      // The workers check space_waiting after taking work, so either they
+      // see it or the push sees the room they made.
+      pthread_cond_broadcast (&pool->cond);
+      atomic_fetch_add (&pool->space_waiting, 1);
 
-  work.function = function;
-  work.argument = argument;
+      if (thread_pool_push (pool, &task))
+        pushed++;
+      else
+        pthread_cond_wait (&pool->cond_space, &pool->mutex);
 
-  pool->queue[pool->queue_tail] = work;
-  pool->queue_tail = (pool->queue_tail + 1) % pool->queue_capacity;
-  pool->queue_size++;
+      atomic_fetch_sub (&pool->space_waiting, 1);
+    }
+
+  if (pushed > 0)
+    atomic_fetch_add (&pool->epoch, 1);
+
+  if (pushed == 1)
+    pthread_cond_signal (&pool->cond);
+  else if (pushed > 1)
+    pthread_cond_broadcast (&pool->cond);
 
-  pthread_cond_signal (&pool->cond);
   pthread_mutex_unlock (&pool->mutex);
+
+  if (drop)
+    for (int i = pushed; i < arguments_amount; ++i)
+      drop (arguments[i]);
 }
 
 
+// Drops all queued work, calling drop on it.  Work that already runs is
+// left alone.
 void
 thread_pool_clear (struct thread_pool *pool)
 {
   pthread_mutex_lock (&pool->mutex);
 
-  pool->queue_size = 0;
-  pool->queue_head = 0;
-  pool->queue_tail = 0;
+  struct thread_pool_queue *queue = &pool->queue;
+
+  // Enqueuing is locked out, so only workers move head meanwhile, and the
+  // slots from head to tail are ours once it moved to tail.
+  unsigned tail = atomic_load (&queue->tail);
+  unsigned head = atomic_load (&queue->head);
+
+  while (head != tail
+         && !atomic_compare_exchange_weak (&queue->head, &head, tail))
+    ;
+
+  int dropped = 0;
+
+  for (unsigned j = head; j != tail; ++j)
+    {
+      struct thread_pool_task task;
+
+      thread_pool_load (&queue->works[j & queue->mask], &task);
+
+      if (task.drop)
+        task.drop (task.argument);
+
+      thread_pool_group_finish (task.group, 1);
+      dropped++;
+    }
+
+  // Workers that took from the queue before head moved have the rest of
+  // their chunk in their deque once taking drops, only the work they run
+  // themselves escapes this, as work that already runs.  It takes them a
+  // few loads and stores.
+  while (atomic_load (&pool->taking) > 0)
+    sched_yield ();
+
+  for (int i = 0; i < pool->threads_amount; ++i)
+    {
+      struct thread_pool_deque *deque = &pool->deques[i];
+      struct thread_pool_task task;
+
+      while (atomic_load (&deque->top) < atomic_load (&deque->bottom))
+        if (thread_pool_deque_steal (deque, &task))
+          {
+            if (task.drop)
+              task.drop (task.argument);
+
+            thread_pool_group_finish (task.group, 1);
+            dropped++;
+          }
+    }
+
+  atomic_fetch_sub (&pool->queued, dropped);
+  atomic_fetch_sub (&pool->pending, dropped);
+
+  if (atomic_load (&pool->pending) == 0)
+    pthread_cond_broadcast (&pool->cond_idle);
+
+  pthread_cond_broadcast (&pool->cond_space);
 
   pthread_mutex_unlock (&pool->mutex);
 }
@@ -130,6 +615,7 @@ thread_pool_stop (struct thread_pool *pool)
 
   pool->stop = 1;
   pthread_cond_broadcast (&pool->cond);
+  pthread_cond_broadcast (&pool->cond_space);
 
   pthread_mutex_unlock (&pool->mutex);
 
@@ -138,6 +624,64 @@ thread_pool_stop (struct thread_pool *pool)
 }
 
 
+void
+thread_pool_wait (struct thread_pool *pool)
+{
+  pthread_mutex_lock (&pool->mutex);
+
+  while (atomic_load (&pool->pending) > 0)
+    pthread_cond_wait (&pool->cond_idle, &pool->mutex);
+
+  pthread_mutex_unlock (&pool->mutex);
+}
+
+
+struct thread_pool_group *
+thread_pool_group_create (void)
+{
+  struct thread_pool_group *group;
+
+  group = malloc (sizeof (struct thread_pool_group));
+
+  pthread_mutex_init (&group->mutex, NULL);
+  pthread_cond_init (&group->cond, NULL);
+
+  atomic_init (&group->pending, 0);
+
+  return group;
+}
+
+
+void
+thread_pool_group_destroy (struct thread_pool_group *group)
+{
+  pthread_mutex_destroy (&group->mutex);
+  pthread_cond_destroy (&group->cond);
+
+  free (group);
+}
+
+
+// Returns 1 once all work enqueued in group has finished or was dropped.
+int
+thread_pool_group_poll (struct thread_pool_group *group)
+{
+  return atomic_load (&group->pending) == 0;
+}
+
+
+void
+thread_pool_group_wait (struct thread_pool_group *group)
+{
+  pthread_mutex_lock (&group->mutex);
+
+  while (atomic_load (&group->pending) > 0)
+    pthread_cond_wait (&group->cond, &group->mutex);
+
+  pthread_mutex_unlock (&group->mutex);
+}
+
+
 int
 thread_pool_get_threads_active (struct thread_pool *pool)
 {
@@ -148,38 +692,60 @@ thread_pool_get_threads_active (struct thread_pool *pool)
 void *
 thread_pool_thread_work (void *argument)
 {
-  struct thread_pool *pool = argument;
+  struct thread_pool_deque *deque = argument;
+  struct thread_pool *pool = deque->pool;
 
   while (1)
     {
-      pthread_mutex_lock (&pool->mutex);
-
-      while (!pool->stop && pool->queue_size == 0)
-        pthread_cond_wait (&pool->cond, &pool->mutex);
+      struct thread_pool_task task;
+      unsigned epoch = atomic_load (&pool->epoch);
 
-      if (pool->stop && pool->queue_size == 0)
+      if (!thread_pool_pop (deque, &task))
         {
-          pthread_mutex_unlock (&pool->mutex);
-          break;
-        }
+          // What was left went to another thief first, there is more.
+          if (thread_pool_stealable (pool))
+            continue;
 
-      struct thread_pool_work work;
+          pthread_mutex_lock (&pool->mutex);
 
-      work = pool->queue[pool->queue_head];
+          // Work that is queued but was not found is on its way into a
+          // deque, whoever takes it moves the epoch once it is there.
+          atomic_fetch_add (&pool->sleeping, 1);
 
-      pool->queue_head = (pool->queue_head + 1) % pool->queue_capacity;
-      pool->queue_size--;
+          while (!pool->stop
+                 && (atomic_load (&pool->queued) == 0
+                     || atomic_load (&pool->epoch) == epoch))
+            pthread_cond_wait (&pool->cond, &pool->mutex);
 
-      pthread_mutex_unlock (&pool->mutex);
+          atomic_fetch_sub (&pool->sleeping, 1);
+
+          int stop = pool->stop && atomic_load (&pool->queued) == 0;
+
+          pthread_mutex_unlock (&pool->mutex);
+
+          if (stop)
+            break;
+
+          continue;
+        }
 
+      atomic_fetch_sub (&pool->queued, 1);
       atomic_fetch_add (&pool->threads_active, 1);
 
-      if (work.function)
-        work.function (work.argument);
+      if (task.function)
+        task.function (task.argument);
 
       atomic_fetch_sub (&pool->threads_active, 1);
+
+      thread_pool_group_finish (task.group, 1);
+
+      if (atomic_fetch_sub (&pool->pending, 1) == 1)
+        {
+          pthread_mutex_lock (&pool->mutex);
+          pthread_cond_broadcast (&pool->cond_idle);
+          pthread_mutex_unlock (&pool->mutex);
+        }
     }
 
   return NULL;
 }
-
@@ -2,18 +2,34 @@
 #define THREAD_POOL_H
 
 struct thread_pool_work;
+struct thread_pool_group;
 struct thread_pool;
 
 struct thread_pool *thread_pool_create (int, int);
 
 void thread_pool_destroy (struct thread_pool *);
 
-void thread_pool_enqueue (struct thread_pool *, void (*) (void *), void *);
+void thread_pool_enqueue (struct thread_pool *, struct thread_pool_group *,
+                          void (*) (void *), void (*) (void *), void *);
+
+void thread_pool_enqueue_batch (struct thread_pool *,
+                                struct thread_pool_group *, void (*) (void *),
+                                void (*) (void *), void **, int);
 
 void thread_pool_clear (struct thread_pool *);
 
 void thread_pool_stop (struct thread_pool *);
 
+void thread_pool_wait (struct thread_pool *);
+
+struct thread_pool_group *thread_pool_group_create (void);
+
+void thread_pool_group_destroy (struct thread_pool_group *);
+
+int thread_pool_group_poll (struct thread_pool_group *);
+
+void thread_pool_group_wait (struct thread_pool_group *);
+
 int thread_pool_get_threads_active (struct thread_pool *);
 
 #endif // THREAD_POOL_H